@@ -0,0 +1,437 @@
+#ifndef DRAGAZO_ASYNC_FATE_H
+#define DRAGAZO_ASYNC_FATE_H
+
+#include <atomic>
+#include <coroutine>
+#include <cstddef>
+#include <new>
+#include <optional>
+#include <utility>
+#include <type_traits>
+
+// async_fate is the coroutine counterpart of fate: its bound function-like object returns an awaitable (e.g. a task that flushes and closes a socket),
+// which can't be awaited from a destructor. instead, every async_fate registers itself with an async_scope,
+// and the coroutine does "co_await scope.close();" on the way out, which awaits every pending async_fate in reverse order of registration.
+// close(true) starts them all at once and resumes the coroutine once they have all finished (for cleanups that don't depend on each other).
+// nothing is allocated outside the coroutine frame: async_fate and async_scope live in the frame, and the small coroutine(s) used to drive
+// the awaitables are placed in a buffer inside the async_scope (only a very large concurrent close() spills over to the heap).
+// as with fate, exceptions thrown by the function, its awaitable, or its result are caught and ignored.
+// WARNING - an async cleanup can only run if close() is awaited. anything still pending when an async_fate (or its async_scope) is destroyed
+//           is abandoned (destroyed without being invoked) - so be sure every path out of the coroutine goes through "co_await scope.close();".
+// none of this is threadsafe, although the awaitables themselves are free to complete on other threads.
+// requires C++20.
+
+class async_scope;
+
+// type-erased part of an async_fate, intrusively linked into its async_scope
+class async_fate_base
+{
+private: // -- data -- //
+
+	friend class async_scope;
+
+	async_scope *scope = nullptr;
+	async_fate_base *prev = nullptr;
+	async_fate_base *next = nullptr;
+
+	// the coroutine driving this node (only used by a concurrent close)
+	std::coroutine_handle<> runner;
+
+protected: // -- derived interface -- //
+
+	// invokes the function and prepares its awaiter. returns true if the awaiter needs to suspend (i.e. it isn't ready).
+	bool (*start)(async_fate_base *self) noexcept = nullptr;
+	// suspends on the awaiter, returning the coroutine to transfer control to
+	std::coroutine_handle<> (*suspend)(async_fate_base *self, std::coroutine_handle<> h) noexcept = nullptr;
+	// collects the awaiter's result (ignoring it) and destroys the awaitable and the function
+	void (*finish)(async_fate_base *self) noexcept = nullptr;
+	// destroys the function without invoking it
+	void (*abandon)(async_fate_base *self) noexcept = nullptr;
+
+	async_fate_base() = default;
+	~async_fate_base() = default;
+
+	async_fate_base(const async_fate_base&) = delete;
+	async_fate_base &operator=(const async_fate_base&) = delete;
+
+	inline void link(async_scope &s) noexcept;
+	inline void unlink() noexcept;
+
+	// returns true iff this node is still waiting in its scope
+	bool linked() const noexcept { return scope; }
+};
+
+// -------------------------------------------------------------- //
+
+class async_scope
+{
+private: // -- data -- //
+
+	friend class async_fate_base;
+
+	// most recently registered pending async_fate (the list runs from newest to oldest)
+	async_fate_base *top = nullptr;
+
+	// storage for the driver coroutine frames. every block is preceded by a header saying whether it came from here or the heap.
+	static constexpr std::size_t arena_size = 1024;
+	static constexpr std::size_t header_size = alignof(std::max_align_t);
+	alignas(std::max_align_t) unsigned char arena[arena_size];
+	std::size_t arena_used = 0;
+
+	void *allocate(std::size_t n) noexcept
+	{
+		const std::size_t total = (header_size + n + alignof(std::max_align_t) - 1) & ~(alignof(std::max_align_t) - 1);
+		unsigned char *block;
+		if (arena_size - arena_used >= total)
+		{
+			block = arena + arena_used;
+			arena_used += total;
+			*reinterpret_cast<bool*>(block) = false;
+		}
+		else
+		{
+			block = static_cast<unsigned char*>(::operator new(total, std::nothrow));
+			if (!block) return nullptr;
+			*reinterpret_cast<bool*>(block) = true;
+		}
+		return block + header_size;
+	}
+	static void deallocate(void *p) noexcept
+	{
+		unsigned char *block = static_cast<unsigned char*>(p) - header_size;
+		// arena blocks are reclaimed all at once when close() finishes
+		if (*reinterpret_cast<bool*>(block)) ::operator delete(block);
+	}
+
+	// detaches and returns the most recently registered pending node (or null)
+	async_fate_base *pop() noexcept
+	{
+		async_fate_base *n = top;
+		if (n) n->unlink();
+		return n;
+	}
+
+	// awaiter that runs a single node through its type-erased interface
+	struct node_awaiter
+	{
+		async_fate_base *n;
+
+		bool await_ready() noexcept { return !n->start(n); }
+		std::coroutine_handle<> await_suspend(std::coroutine_handle<> h) noexcept { return n->suspend(n, h); }
+		void await_resume() noexcept { n->finish(n); }
+	};
+
+	struct closer;
+
+	// minimal coroutine type used to drive the awaitables. frames are placed in the scope's arena.
+	struct runner
+	{
+		struct promise_type
+		{
+			closer &owner;
+
+			template<typename... Args>
+			promise_type(async_scope&, closer &c, Args&...) noexcept : owner(c) {}
+
+			template<typename... Args>
+			static void *operator new(std::size_t n, async_scope &s, Args&...) noexcept { return s.allocate(n); }
+			static void operator delete(void *p) noexcept { deallocate(p); }
+
+			static runner get_return_object_on_allocation_failure() noexcept { return {}; }
+			runner get_return_object() noexcept { return {std::coroutine_handle<promise_type>::from_promise(*this)}; }
+
+			std::suspend_always initial_suspend() noexcept { return {}; }
+
+			// the last runner to finish resumes the coroutine that is awaiting close()
+			struct final_awaiter
+			{
+				bool await_ready() noexcept { return false; }
+				std::coroutine_handle<> await_suspend(std::coroutine_handle<promise_type> h) noexcept
+				{
+					closer &c = h.promise().owner;
+					if (c.remaining.fetch_sub(1, std::memory_order_acq_rel) == 1) return c.continuation;
+					return std::noop_coroutine();
+				}
+				void await_resume() noexcept {}
+			};
+			final_awaiter final_suspend() noexcept { return {}; }
+
+			void return_void() noexcept {}
+			void unhandled_exception() noexcept {}
+		};
+
+		std::coroutine_handle<promise_type> handle;
+	};
+
+	// awaits every pending node, newest first
+	static runner run_serial(async_scope &s, closer&)
+	{
+		while (async_fate_base *n = s.pop()) co_await node_awaiter{n};
+	}
+	// awaits a single node
+	static runner run_one(async_scope&, closer&, async_fate_base *n)
+	{
+		co_await node_awaiter{n};
+	}
+
+	// the awaiter returned by close()
+	struct closer
+	{
+		async_scope &scope;
+		bool concurrent;
+
+		closer(async_scope &s, bool c) noexcept : scope(s), concurrent(c) {}
+
+		// runners still going (+1 for await_suspend itself during a concurrent launch)
+		std::atomic<std::size_t> remaining{0};
+		std::coroutine_handle<> continuation;
+
+		// the serial runner, or the list of nodes started by a concurrent close (each holding its runner)
+		std::coroutine_handle<> serial;
+		async_fate_base *started = nullptr;
+
+		bool await_ready() noexcept { return !scope.top; }
+
+		std::coroutine_handle<> await_suspend(std::coroutine_handle<> h) noexcept
+		{
+			continuation = h;
+
+			if (!concurrent)
+			{
+				remaining.store(1, std::memory_order_relaxed);
+				serial = run_serial(scope, *this).handle;
+				if (!serial)
+				{
+					scope.abandon_all();
+					return h;
+				}
+				return serial;
+			}
+
+			remaining.store(1, std::memory_order_relaxed);
+			while (async_fate_base *n = scope.pop())
+			{
+				n->runner = run_one(scope, *this, n).handle;
+				if (!n->runner)
+				{
+					n->abandon(n);
+					continue;
+				}
+				n->next = started;
+				started = n;
+
+				remaining.fetch_add(1, std::memory_order_relaxed);
+				n->runner.resume();
+			}
+			// if everything already finished, carry on right away (otherwise the last runner resumes us)
+			if (remaining.fetch_sub(1, std::memory_order_acq_rel) == 1) return h;
+			return std::noop_coroutine();
+		}
+
+		void await_resume() noexcept
+		{
+			if (serial) serial.destroy();
+			for (async_fate_base *n = started; n; n = n->next)
+			{
+				n->runner.destroy();
+				n->runner = nullptr;
+			}
+			started = nullptr;
+			scope.arena_used = 0;
+		}
+	};
+
+	void abandon_all() noexcept
+	{
+		while (async_fate_base *n = pop()) n->abandon(n);
+	}
+
+public: // -- ctor / dtor / asgn -- //
+
+	async_scope() noexcept {}
+
+	// anything still pending is abandoned (see the warning above)
+	~async_scope() { abandon_all(); }
+
+	async_scope(const async_scope&) = delete;
+	async_scope &operator=(const async_scope&) = delete;
+
+public: // -- interface -- //
+
+	// returns an awaitable that runs every pending async_fate registered with this scope (newest first).
+	// if concurrent is true, they are all started at once and the awaiting coroutine resumes once all of them have finished.
+	// async_fates registered while a serial close is running are run by it too. after a concurrent close, they are left for the next close().
+	closer close(bool concurrent = false) noexcept { return closer(*this, concurrent); }
+
+	// returns true iff nothing is pending
+	bool empty() const noexcept { return !top; }
+};
+
+inline void async_fate_base::link(async_scope &s) noexcept
+{
+	scope = &s;
+	prev = nullptr;
+	next = s.top;
+	if (next) next->prev = this;
+	s.top = this;
+}
+inline void async_fate_base::unlink() noexcept
+{
+	if (prev) prev->next = next;
+	else scope->top = next;
+	if (next) next->prev = prev;
+	scope = nullptr;
+	prev = next = nullptr;
+}
+
+// -------------------------------------------------------------- //
+
+template<typename T>
+class async_fate : private async_fate_base
+{
+private: // -- types -- //
+
+	// gets the awaiter for an awaitable, the same way co_await does
+	template<typename A>
+	static auto has_member_co_await(int) -> decltype(std::declval<A>().operator co_await(), std::true_type{});
+	template<typename A>
+	static std::false_type has_member_co_await(...);
+	template<typename A>
+	static auto has_free_co_await(int) -> decltype(operator co_await(std::declval<A>()), std::true_type{});
+	template<typename A>
+	static std::false_type has_free_co_await(...);
+
+	template<typename A>
+	static decltype(auto) get_awaiter(A &&a)
+	{
+		if constexpr (decltype(has_member_co_await<A>(0))::value) return std::forward<A>(a).operator co_await();
+		else if constexpr (decltype(has_free_co_await<A>(0))::value) return operator co_await(std::forward<A>(a));
+		else return std::forward<A>(a);
+	}
+
+	typedef std::decay_t<decltype(std::declval<T&>()())> awaitable_t;
+	typedef decltype(get_awaiter(std::declval<awaitable_t>())) awaiter_ref_t;
+
+	// if get_awaiter() hands back a reference (e.g. the awaitable is its own awaiter), just point at it
+	static constexpr bool awaiter_is_ref = std::is_reference_v<awaiter_ref_t>;
+	typedef std::conditional_t<awaiter_is_ref, std::remove_reference_t<awaiter_ref_t>*, std::optional<std::decay_t<awaiter_ref_t>>> awaiter_holder_t;
+
+private: // -- data -- //
+
+	std::optional<T> func;
+	std::optional<awaitable_t> awaitable;
+	awaiter_holder_t awaiter{};
+
+	// set if invoking the function or suspending on its awaiter threw (so there's nothing to resume)
+	bool failed = false;
+
+	auto &get() noexcept { return *awaiter; }
+
+	static bool start_impl(async_fate_base *base) noexcept
+	{
+		async_fate *self = static_cast<async_fate*>(base);
+		try
+		{
+			self->awaitable.emplace((*self->func)());
+			if constexpr (awaiter_is_ref)
+			{
+				awaiter_ref_t w = get_awaiter(std::move(*self->awaitable));
+				self->awaiter = &w;
+			}
+			else self->awaiter.emplace(get_awaiter(std::move(*self->awaitable)));
+			return !self->get().await_ready();
+		}
+		catch (...)
+		{
+			self->failed = true;
+			return false;
+		}
+	}
+	static std::coroutine_handle<> suspend_impl(async_fate_base *base, std::coroutine_handle<> h) noexcept
+	{
+		async_fate *self = static_cast<async_fate*>(base);
+		try
+		{
+			typedef decltype(self->get().await_suspend(h)) result_t;
+			if constexpr (std::is_void_v<result_t>)
+			{
+				self->get().await_suspend(h);
+				return std::noop_coroutine();
+			}
+			else if constexpr (std::is_same_v<result_t, bool>) return self->get().await_suspend(h) ? std::noop_coroutine() : h;
+			else return self->get().await_suspend(h);
+		}
+		catch (...)
+		{
+			self->failed = true;
+			return h;
+		}
+	}
+	static void finish_impl(async_fate_base *base) noexcept
+	{
+		async_fate *self = static_cast<async_fate*>(base);
+		if (!self->failed)
+		{
+			try { (void)self->get().await_resume(); }
+			catch (...) {}
+		}
+		self->failed = false;
+		if constexpr (awaiter_is_ref) self->awaiter = nullptr;
+		else self->awaiter.reset();
+		self->awaitable.reset();
+		// the function goes last - the awaitable may well refer to it (e.g. a coroutine lambda's captures)
+		self->func.reset();
+	}
+	static void abandon_impl(async_fate_base *base) noexcept
+	{
+		static_cast<async_fate*>(base)->func.reset();
+	}
+
+public: // -- ctor / dtor / asgn -- //
+
+	// creates an async_fate for the given function-like object (which must return an awaitable) and registers it with the given scope.
+	// the argument will be forwarded to the T constructor. on failure, nothing is registered and an exception is thrown.
+	template<typename J>
+	async_fate(async_scope &s, J &&arg) : func(std::forward<J>(arg))
+	{
+		start = &start_impl;
+		suspend = &suspend_impl;
+		finish = &finish_impl;
+		abandon = &abandon_impl;
+		link(s);
+	}
+
+	// if still pending, the function is abandoned (it can't be awaited from here - see the warning above)
+	~async_fate() { release(); }
+
+	async_fate(const async_fate&) = delete;
+	async_fate &operator=(const async_fate&) = delete;
+
+public: // -- utilities -- //
+
+	// abandons the function (it will not be invoked by the scope's close()).
+	// WARNING - must not be called while this async_fate is being awaited by close().
+	void release() noexcept
+	{
+		if (linked())
+		{
+			unlink();
+			func.reset();
+		}
+	}
+
+	// returns true iff this object is still waiting to be run by its scope
+	explicit operator bool() const noexcept { return linked(); }
+	// returns true iff this object is not waiting to be run by its scope
+	bool operator!() const noexcept { return !linked(); }
+
+	// returns true iff this object is not waiting to be run by its scope
+	bool empty() const noexcept { return !linked(); }
+};
+
+// creates an async_fate registered with the given scope from the given function-like object.
+// async_fate can't be moved, so this relies on guaranteed copy elision - bind the result directly.
+template<typename T>
+async_fate<std::decay_t<T>> make_async_fate(async_scope &s, T &&arg) { return async_fate<std::decay_t<T>>(s, std::forward<T>(arg)); }
+
+#endif
@@ -0,0 +1,201 @@
+#ifndef DRAGAZO_ATOMIC_FILE_BATCH_H
+#define DRAGAZO_ATOMIC_FILE_BATCH_H
+
+#include <atomic>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <utility>
+#include <vector>
+#include <algorithm>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+// how atomic_file_batch::commit() makes the temp files durable
+enum class batch_sync
+{
+	// starts writeback for every file, then waits on each one in turn with fdatasync (so the waits overlap instead of serializing). the default.
+	batched,
+	// one syncfs() on the filesystem of the first file (linux only - falls back to batched elsewhere).
+	// the cheapest in syscalls, but it also flushes everything else dirty on that filesystem, so it only pays off on a quiet filesystem.
+	// all files must be on the same filesystem.
+	filesystem,
+};
+
+// atomic_file_batch writes a group of files with the write-temp-then-rename pattern, sharing the expensive syncs between all of them (posix only).
+// add() creates a temp file next to its destination, and commit() makes all temp files durable together, renames each over its destination,
+// and then syncs each distinct directory once - so a batch of n files in one directory costs far fewer waits than n separate fsync/rename/fsync sequences.
+// every file has an implicit rollback guard: anything that hasn't been committed when the batch is destroyed (or discarded) has its temp file unlinked.
+// a crash at any point leaves each destination with either its old contents or its complete new contents (never a partial file),
+// but the batch as a whole is not atomic - a crash (or a failure) during commit() can leave some files renamed and others not.
+// not threadsafe.
+class atomic_file_batch
+{
+private: // -- data -- //
+
+	struct file
+	{
+		std::string path;
+		std::string temp_path;
+		int fd = -1;
+	};
+
+	std::vector<file> files;
+	batch_sync mode;
+
+	[[noreturn]] static void fail(const char *what) { throw std::system_error(errno, std::generic_category(), what); }
+
+	// the directory part of a path (for syncing the directory entry)
+	static std::string directory_of(const std::string &path)
+	{
+		const std::size_t slash = path.find_last_of('/');
+		if (slash == std::string::npos) return ".";
+		if (slash == 0) return "/";
+		return path.substr(0, slash);
+	}
+
+	static std::uint64_t next_temp_id() noexcept
+	{
+		static std::atomic<std::uint64_t> id{0};
+		return id.fetch_add(1, std::memory_order_relaxed);
+	}
+
+	// rolls back one file (closes it and unlinks its temp file), if it's still pending
+	static void discard_file(file &f) noexcept
+	{
+		if (f.fd < 0) return;
+		::close(f.fd);
+		::unlink(f.temp_path.c_str());
+		f.fd = -1;
+	}
+
+	// makes the data of every pending file durable
+	void sync_data()
+	{
+#ifdef __linux__
+		if (mode == batch_sync::filesystem)
+		{
+			for (file &f : files) if (f.fd >= 0)
+			{
+				if (::syncfs(f.fd) != 0) fail("atomic_file_batch: syncfs");
+				return;
+			}
+			return;
+		}
+		// kick off writeback for everything first, so the device sees all of it at once
+		for (file &f : files) if (f.fd >= 0) ::sync_file_range(f.fd, 0, 0, SYNC_FILE_RANGE_WRITE);
+#endif
+		for (file &f : files) if (f.fd >= 0 && ::fdatasync(f.fd) != 0) fail("atomic_file_batch: fdatasync");
+	}
+
+public: // -- ctor / dtor / asgn -- //
+
+	explicit atomic_file_batch(batch_sync sync_mode = batch_sync::batched) noexcept : mode(sync_mode) {}
+
+	// rolls back everything that hasn't been committed
+	~atomic_file_batch() { rollback(); }
+
+	atomic_file_batch(const atomic_file_batch&) = delete;
+	atomic_file_batch &operator=(const atomic_file_batch&) = delete;
+
+	atomic_file_batch(atomic_file_batch &&other) noexcept : files(std::move(other.files)), mode(other.mode) { other.files.clear(); }
+	// rolls back everything in this batch that hasn't been committed, then takes over other's files
+	atomic_file_batch &operator=(atomic_file_batch &&other) noexcept
+	{
+		if (this != &other)
+		{
+			rollback();
+			files = std::move(other.files);
+			mode = other.mode;
+			other.files.clear();
+		}
+		return *this;
+	}
+
+public: // -- interface -- //
+
+	// creates a temp file that will replace path on commit(), and returns its index in the batch.
+	// the temp file is created in the same directory (so the rename stays within one filesystem). throws std::system_error on failure.
+	std::size_t add(std::string path)
+	{
+		file f;
+		f.temp_path = path + ".tmp." + std::to_string(::getpid()) + "." + std::to_string(next_temp_id());
+		f.path = std::move(path);
+
+		files.reserve(files.size() + 1); // so the push_back below can't throw after the file exists
+		f.fd = ::open(f.temp_path.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+		if (f.fd < 0) fail("atomic_file_batch: open");
+		files.push_back(std::move(f));
+		return files.size() - 1;
+	}
+
+	// returns the descriptor of the given file's temp file, for writing (or -1 if it has already been committed or discarded)
+	int fd(std::size_t index) const noexcept { return files[index].fd; }
+
+	// writes all of data to the given file's temp file. throws std::system_error on failure.
+	void write(std::size_t index, std::string_view data)
+	{
+		const int d = files[index].fd;
+		while (!data.empty())
+		{
+			const ::ssize_t n = ::write(d, data.data(), data.size());
+			if (n < 0)
+			{
+				if (errno == EINTR) continue;
+				fail("atomic_file_batch: write");
+			}
+			data.remove_prefix((std::size_t)n);
+		}
+	}
+
+	// rolls back a single file (its temp file is closed and unlinked, and its destination is left alone)
+	void discard(std::size_t index) noexcept { discard_file(files[index]); }
+
+	// makes every pending file durable, renames each over its destination, and syncs their directories (each distinct one once).
+	// the batch is empty afterwards. throws std::system_error on failure - files that weren't renamed yet are still pending (and are rolled back as usual).
+	void commit()
+	{
+		sync_data();
+
+		std::vector<std::string> dirs;
+		for (file &f : files)
+		{
+			if (f.fd < 0) continue;
+			if (::rename(f.temp_path.c_str(), f.path.c_str()) != 0) fail("atomic_file_batch: rename");
+			::close(f.fd);
+			f.fd = -1;
+			dirs.push_back(directory_of(f.path));
+		}
+
+		std::sort(dirs.begin(), dirs.end());
+		dirs.erase(std::unique(dirs.begin(), dirs.end()), dirs.end());
+		for (const std::string &dir : dirs)
+		{
+			const int d = ::open(dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+			if (d < 0) fail("atomic_file_batch: open directory");
+			const int r = ::fsync(d);
+			::close(d);
+			if (r != 0) fail("atomic_file_batch: fsync directory");
+		}
+
+		files.clear();
+	}
+
+	// rolls back every pending file, leaving the batch empty
+	void rollback() noexcept
+	{
+		for (file &f : files) discard_file(f);
+		files.clear();
+	}
+
+	// returns the number of files in the batch (including discarded ones, whose indices stay valid until commit() or rollback())
+	std::size_t size() const noexcept { return files.size(); }
+	// returns true iff the batch has no files
+	bool empty() const noexcept { return files.empty(); }
+};
+
+#endif
@@ -0,0 +1,109 @@
+#ifndef DRAGAZO_COMPLETION_FATE_H
+#define DRAGAZO_COMPLETION_FATE_H
+
+#include <atomic>
+#include <utility>
+#include <type_traits>
+
+#include "fate.h"
+
+// completion_fate is a fate that other threads can wait on.
+// invoking it (explicitly or via the destructor) runs the bound function and then atomically publishes completion, waking any waiters.
+// waiting is built on std::atomic::wait/notify_all (a futex on linux), so there is no mutex or condition variable anywhere.
+// the notify is skipped entirely unless someone is actually blocked, so completing with no waiters costs a single atomic exchange (no syscall).
+// release() also counts as completion (the contract is over, so there is nothing left to wait for).
+// invoking/releasing is not threadsafe (just like fate), but wait() and try_wait() may be called from any number of threads.
+// completion_fate is neither copyable nor movable, since waiters hold references to it. waiters must be done with it before it is destroyed.
+// requires C++20.
+template<typename T>
+class completion_fate
+{
+private: // -- data -- //
+
+	// the function to invoke
+	fate<T> func;
+
+	// state bits: done is set once the function has finished (or been released).
+	// waiting is set by any thread that is about to block, so that the completing thread knows it has to notify.
+	static constexpr unsigned char done = 1;
+	static constexpr unsigned char waiting = 2;
+	std::atomic<unsigned char> state;
+
+	// publishes completion, waking waiters only if there are any
+	void complete() noexcept
+	{
+		if (state.exchange(done, std::memory_order_acq_rel) & waiting) state.notify_all();
+	}
+
+public: // -- ctor / dtor / asgn -- //
+
+	// creates a completion_fate that is already complete (empty)
+	completion_fate() noexcept : state(done) {}
+
+	// creates a completion_fate for the given function-like object - the argument will be forwarded to the T constructor.
+	// on failure, an exception is thrown.
+	template<typename J>
+	explicit completion_fate(J &&arg) noexcept(noexcept(fate<T>(std::forward<J>(arg)))) : func(std::forward<J>(arg)), state(0) {}
+
+	~completion_fate() { (*this)(); }
+
+	completion_fate(const completion_fate&) = delete;
+	completion_fate &operator=(const completion_fate&) = delete;
+
+public: // -- utilities -- //
+
+	// triggers the stored function (if any), then publishes completion to waiters.
+	// if the function-like object throws an exception, it is caught and ignored.
+	// the resulting object is guaranteed to be empty (and complete) after this.
+	void operator()() noexcept
+	{
+		if (func)
+		{
+			func();
+			complete();
+		}
+	}
+
+	// abandons the function (will no longer be executed) and publishes completion to waiters
+	void release() noexcept
+	{
+		if (func)
+		{
+			func.release();
+			complete();
+		}
+	}
+
+	// returns true iff the bound function has finished (or was released). never blocks. threadsafe.
+	// on success, everything the function did happens-before the return.
+	bool try_wait() const noexcept { return state.load(std::memory_order_acquire) & done; }
+
+	// blocks until the bound function has finished (or was released). threadsafe.
+	// everything the function did happens-before the return.
+	void wait() noexcept
+	{
+		unsigned char s = state.load(std::memory_order_acquire);
+		while (!(s & done))
+		{
+			// announce ourselves before sleeping so the completing thread knows to notify
+			if (!(s & waiting) && !state.compare_exchange_weak(s, s | waiting, std::memory_order_acquire)) continue;
+			state.wait(s | waiting, std::memory_order_acquire);
+			s = state.load(std::memory_order_acquire);
+		}
+	}
+
+	// returns true iff this object is still associated with a function object (i.e. not yet complete)
+	explicit operator bool() const noexcept { return (bool)func; }
+	// returns true iff this object is not associated with a function object
+	bool operator!() const noexcept { return !func; }
+
+	// returns true iff this object is not associated with a function object
+	bool empty() const noexcept { return func.empty(); }
+};
+
+// creates a completion_fate object from the given function-like object.
+// completion_fate can't be moved, so this relies on guaranteed copy elision - bind the result directly, e.g. "auto unmapped = make_completion_fate(f);".
+template<typename T>
+completion_fate<std::decay_t<T>> make_completion_fate(T &&arg) { return completion_fate<std::decay_t<T>>(std::forward<T>(arg)); }
+
+#endif
@@ -0,0 +1,251 @@
+#ifndef DRAGAZO_CONCURRENT_FATE_COLLECTOR_H
+#define DRAGAZO_CONCURRENT_FATE_COLLECTOR_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <thread>
+#include <utility>
+#include <type_traits>
+#include <vector>
+
+#include "fate.h"
+
+// concurrent_fate_collector gathers cleanup (fates) registered by many threads (e.g. the body of a parallel_for) on behalf of an enclosing scope.
+// every thread appends to its own segment, so registration never touches a shared lock - the only shared write is a single lock-free push
+// the first time a thread registers with a given collector.
+// a thread finds its segment through a small per-thread cache (4 collectors). a thread using more collectors than that at once falls back to
+// walking the collector's segment list (one per registered thread, read-only) on cache misses - slower, but still no allocation or shared writes.
+// small function-like objects are stored inline in their segment - larger ones cost a single allocation.
+// at scope end, run_all() (or the destructor) invokes everything: each thread's fates in reverse registration order, optionally with segments run in parallel.
+// add() is threadsafe. run_all()/release() are not - they must not race with add() (i.e. call them once the parallel section has joined).
+class concurrent_fate_collector
+{
+private: // -- data -- //
+
+	struct entry
+	{
+		// invokes (if run is true) or releases the stored fate, then destroys it
+		void (*finish)(void *storage, bool run) noexcept;
+		alignas(void*) unsigned char storage[4 * sizeof(void*)];
+	};
+
+	template<typename T>
+	static constexpr bool fits_inline = sizeof(fate<T>) <= sizeof(entry::storage) && alignof(fate<T>) <= alignof(void*);
+
+	template<typename T>
+	static void finish_inline(void *storage, bool run) noexcept
+	{
+		fate<T> &f = *static_cast<fate<T>*>(storage);
+		if (run) f();
+		else f.release();
+		f.~fate<T>();
+	}
+	template<typename T>
+	static void finish_heap(void *storage, bool run) noexcept
+	{
+		fate<T> *f = *static_cast<fate<T>**>(storage);
+		if (!run) f->release();
+		delete f;
+	}
+
+	// entries live in chunks that never move
+	static constexpr std::size_t chunk_size = 16;
+	struct chunk
+	{
+		chunk *prev = nullptr;
+		std::size_t count = 0;
+		entry entries[chunk_size];
+	};
+
+	// one thread's entries. only ever touched by that thread until run_all().
+	struct segment
+	{
+		segment *next = nullptr;
+		std::thread::id owner = std::this_thread::get_id();
+		chunk first;
+		chunk *top = &first;
+
+		entry &next_slot()
+		{
+			if (top->count == chunk_size)
+			{
+				chunk *c = new chunk;
+				c->prev = top;
+				top = c;
+			}
+			return top->entries[top->count];
+		}
+
+		// finishes every entry in reverse registration order
+		void finish_all(bool run) noexcept
+		{
+			for (;;)
+			{
+				while (top->count)
+				{
+					entry &e = top->entries[--top->count];
+					e.finish(e.storage, run);
+				}
+				if (!top->prev) break;
+				chunk *old = top;
+				top = top->prev;
+				delete old;
+			}
+		}
+	};
+
+	// lock-free list of every segment created for this collector
+	std::atomic<segment*> segments{nullptr};
+
+	// identifies this collector (and this round of it) in the per-thread caches - never reused, unlike addresses
+	std::uint64_t id;
+
+	static std::uint64_t next_id() noexcept
+	{
+		static std::atomic<std::uint64_t> ids{0};
+		return ids.fetch_add(1, std::memory_order_relaxed) + 1;
+	}
+
+	// a small per-thread cache mapping collector ids to that thread's segment
+	struct cache_entry
+	{
+		std::uint64_t id = 0;
+		segment *seg = nullptr;
+	};
+	static constexpr std::size_t cache_size = 4;
+	static cache_entry *cache() noexcept
+	{
+		static thread_local cache_entry c[cache_size];
+		return c;
+	}
+
+	// gets (or creates) the calling thread's segment
+	segment &local()
+	{
+		cache_entry *c = cache();
+		for (std::size_t i = 0; i < cache_size; ++i) if (c[i].id == id) return *c[i].seg;
+
+		// cache miss - we may still have a segment from before we were evicted (segments are only ever pushed, and their owner and next never change)
+		const std::thread::id me = std::this_thread::get_id();
+		segment *s = segments.load(std::memory_order_acquire);
+		while (s && s->owner != me) s = s->next;
+
+		if (!s)
+		{
+			s = new segment;
+			s->next = segments.load(std::memory_order_relaxed);
+			while (!segments.compare_exchange_weak(s->next, s, std::memory_order_release, std::memory_order_relaxed)) {}
+		}
+
+		// evict the oldest cache entry
+		for (std::size_t i = cache_size - 1; i > 0; --i) c[i] = c[i - 1];
+		c[0].id = id;
+		c[0].seg = s;
+		return *s;
+	}
+
+	// detaches every segment and starts a new round (so stale per-thread cache entries can't match)
+	segment *take() noexcept
+	{
+		id = next_id();
+		return segments.exchange(nullptr, std::memory_order_acquire);
+	}
+
+public: // -- ctor / dtor / asgn -- //
+
+	concurrent_fate_collector() noexcept : id(next_id()) {}
+
+	// runs everything that's still registered (serially)
+	~concurrent_fate_collector() { run_all(); }
+
+	concurrent_fate_collector(const concurrent_fate_collector&) = delete;
+	concurrent_fate_collector &operator=(const concurrent_fate_collector&) = delete;
+
+public: // -- interface -- //
+
+	// registers a fate (which is moved from) in the calling thread's segment. threadsafe.
+	// on failure (out of memory), the fate is left untouched and an exception is thrown.
+	template<typename T>
+	void add(fate<T> &&f)
+	{
+		if (!f) return;
+		segment &s = local();
+		entry &e = s.next_slot();
+		if constexpr (fits_inline<T>)
+		{
+			new (e.storage) fate<T>(std::move(f));
+			e.finish = &finish_inline<T>;
+		}
+		else
+		{
+			*reinterpret_cast<fate<T>**>(e.storage) = new fate<T>(std::move(f));
+			e.finish = &finish_heap<T>;
+		}
+		++s.top->count;
+	}
+	// registers a function-like object in the calling thread's segment. threadsafe.
+	template<typename T>
+	void add(T &&arg) { add(make_fate(std::forward<T>(arg))); }
+
+	// invokes every registered fate - each thread's in reverse registration order (the order between threads is unspecified).
+	// if parallel is true, segments are run concurrently on up to std::thread::hardware_concurrency() threads (falling back to serial if threads can't be created).
+	// afterwards the collector is empty and can be reused. not threadsafe.
+	void run_all(bool parallel = false) noexcept
+	{
+		segment *list = take();
+		if (!list) return;
+
+		if (parallel && list->next)
+		{
+			std::vector<segment*> segs;
+			try { for (segment *s = list; s; s = s->next) segs.push_back(s); }
+			catch (...) { segs.clear(); }
+
+			std::size_t threads = std::thread::hardware_concurrency();
+			if (threads > segs.size()) threads = segs.size();
+
+			if (threads > 1)
+			{
+				std::atomic<std::size_t> next{0};
+				auto work = [&]() noexcept
+				{
+					for (std::size_t i; (i = next.fetch_add(1, std::memory_order_relaxed)) < segs.size(); ) segs[i]->finish_all(true);
+				};
+
+				std::vector<std::thread> workers;
+				try
+				{
+					workers.reserve(threads - 1);
+					for (std::size_t i = 1; i < threads; ++i) workers.emplace_back(work);
+				}
+				catch (...) {}
+
+				work();
+				for (auto &w : workers) w.join();
+			}
+		}
+
+		// anything the parallel run didn't take care of (or all of it, if running serially)
+		for (segment *s = list, *next; s; s = next)
+		{
+			next = s->next;
+			s->finish_all(true);
+			delete s;
+		}
+	}
+
+	// abandons every registered fate (none of them will be invoked). not threadsafe.
+	void release() noexcept
+	{
+		for (segment *s = take(), *next; s; s = next)
+		{
+			next = s->next;
+			s->finish_all(false);
+			delete s;
+		}
+	}
+};
+
+#endif
@@ -0,0 +1,100 @@
+#ifndef DRAGAZO_COUNTDOWN_FATE_H
+#define DRAGAZO_COUNTDOWN_FATE_H
+
+#include <atomic>
+#include <cstddef>
+#include <utility>
+#include <type_traits>
+
+#include "fate.h"
+
+// countdown_fate is a fate that is shared by a fixed number of participants (e.g. the subtasks of a fan-out) and fires once all of them have arrived.
+// arrive() is a single atomic decrement - whichever thread brings the count to zero invokes the bound function inline, so nobody ever blocks waiting.
+// any participant may instead call arrive_and_release() to cancel: the count still goes down, but when it reaches zero the function is abandoned instead of invoked.
+// unlike fate, arrive() and arrive_and_release() are threadsafe. everything else (construction, destruction, release()) is not.
+// if the countdown_fate is destroyed before the count reaches zero, it behaves like a fate and invokes the function (unless cancelled).
+// countdown_fate is neither copyable nor movable, since other threads hold references to it - put it somewhere with a stable address (e.g. a shared_ptr or the parent's frame).
+template<typename T>
+class countdown_fate
+{
+private: // -- data -- //
+
+	// number of participants that have not arrived yet
+	std::atomic<std::size_t> count;
+
+	// set by arrive_and_release() - seen by the last arriver thanks to the acq_rel decrement
+	std::atomic<bool> cancelled;
+
+	// the function to invoke once the count hits zero
+	fate<T> func;
+
+	// called by whoever brought the count to zero
+	void finish() noexcept
+	{
+		if (cancelled.load(std::memory_order_relaxed)) func.release();
+		else func();
+	}
+
+public: // -- ctor / dtor / asgn -- //
+
+	// creates a countdown_fate that invokes the given function-like object once n participants have arrived.
+	// the argument will be forwarded to the T constructor. if n is zero, the function is invoked immediately.
+	// on failure, an exception is thrown.
+	template<typename J>
+	countdown_fate(std::size_t n, J &&arg) noexcept(noexcept(fate<T>(std::forward<J>(arg)))) : count(n), cancelled(false), func(std::forward<J>(arg))
+	{
+		if (n == 0) func();
+	}
+
+	// if the count never reached zero, the function is invoked anyway (unless a participant cancelled)
+	~countdown_fate()
+	{
+		if (cancelled.load(std::memory_order_relaxed)) func.release();
+	}
+
+	countdown_fate(const countdown_fate&) = delete;
+	countdown_fate &operator=(const countdown_fate&) = delete;
+
+public: // -- utilities -- //
+
+	// marks n participants as having arrived. if this brings the count to zero, the function is invoked on the calling thread before returning.
+	// arriving more times than the initial count is undefined behavior.
+	// returns true iff the calling thread was the last to arrive.
+	bool arrive(std::size_t n = 1) noexcept
+	{
+		if (count.fetch_sub(n, std::memory_order_acq_rel) != n) return false;
+		finish();
+		return true;
+	}
+
+	// marks a participant as having arrived and cancels the contract - the function will be abandoned rather than invoked.
+	// (if this brings the count to zero, the function is destroyed on the calling thread before returning).
+	// returns true iff the calling thread was the last to arrive.
+	bool arrive_and_release() noexcept
+	{
+		cancelled.store(true, std::memory_order_relaxed);
+		return arrive();
+	}
+
+	// abandons the function immediately (it will never be invoked). remaining arrivals still count down, but do nothing.
+	// WARNING - not threadsafe: no participant may be arriving concurrently.
+	void release() noexcept { func.release(); }
+
+	// returns the number of participants that have not yet arrived
+	std::size_t remaining() const noexcept { return count.load(std::memory_order_acquire); }
+
+	// returns true iff the function has not yet been invoked or released (not threadsafe with the final arrive())
+	explicit operator bool() const noexcept { return (bool)func; }
+	// returns true iff the function has been invoked or released (not threadsafe with the final arrive())
+	bool operator!() const noexcept { return !func; }
+
+	// returns true iff the function has been invoked or released (not threadsafe with the final arrive())
+	bool empty() const noexcept { return func.empty(); }
+};
+
+// creates a countdown_fate for n participants from the given function-like object.
+// countdown_fate can't be moved, so this relies on guaranteed copy elision (C++17) - bind the result directly, e.g. "auto done = make_countdown_fate(n, f);".
+template<typename T>
+countdown_fate<std::decay_t<T>> make_countdown_fate(std::size_t n, T &&arg) { return countdown_fate<std::decay_t<T>>(n, std::forward<T>(arg)); }
+
+#endif
@@ -0,0 +1,435 @@
+#ifndef DRAGAZO_DEADLINE_FATE_H
+#define DRAGAZO_DEADLINE_FATE_H
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <type_traits>
+
+#include "fate.h"
+
+// timer_wheel is a hierarchical timing wheel (6 levels of 64 slots) for large numbers of outstanding deadlines.
+// arming and cancelling a timer are O(1) (link/unlink in an intrusive list), and advancing time only visits slots that actually hold timers.
+// timers are intrusive (see timer_wheel::timer) so the wheel itself never allocates.
+// time is measured in ticks of a fixed resolution since the wheel was created. a timer fires on the first advance() at or after its deadline tick.
+// all member functions are threadsafe. expired timers are fired by whichever thread calls advance(), after the wheel's lock has been released.
+class timer_wheel
+{
+private: // -- timer states -- //
+
+	enum : unsigned char { idle, armed_state, firing };
+
+public: // -- types -- //
+
+	typedef std::chrono::steady_clock clock;
+
+	// an intrusive timer node. derive from this (see deadline_fate) and set fire to the function to call on expiry.
+	// a timer must be cancelled (or have fired) before it is destroyed.
+	class timer
+	{
+	private: // -- data -- //
+
+		friend class timer_wheel;
+
+		timer *prev = nullptr;
+		timer *next = nullptr;
+
+		// the deadline tick
+		std::uint64_t expiry = 0;
+
+		// where the timer currently lives in the wheel (only meaningful while armed)
+		unsigned char level = 0;
+		unsigned char slot = 0;
+
+		// idle (not in the wheel), armed (in the wheel), or firing (removed from the wheel and being run by advance())
+		std::atomic<unsigned char> state{idle};
+
+	protected: // -- derived interface -- //
+
+		// called (without the wheel's lock held) when the timer expires
+		void (*fire)(timer *self) noexcept = nullptr;
+
+		timer() = default;
+		~timer() = default;
+
+		timer(const timer&) = delete;
+		timer &operator=(const timer&) = delete;
+
+	public: // -- utilities -- //
+
+		// returns true iff the timer is currently waiting in a wheel
+		bool armed() const noexcept { return state.load(std::memory_order_acquire) == armed_state; }
+	};
+
+private: // -- data -- //
+
+	static constexpr unsigned bits = 6;
+	static constexpr unsigned slots = 1u << bits;
+	static constexpr unsigned levels = 6;
+
+	// number of ticks covered by one slot at the given level
+	static constexpr std::uint64_t span(unsigned level) noexcept { return std::uint64_t(1) << (bits * level); }
+
+	timer *wheel[levels][slots] = {};
+	// bit i of occupied[l] is set iff wheel[l][i] is non-empty
+	std::uint64_t occupied[levels] = {};
+
+	// the last tick that has been processed
+	std::uint64_t current = 0;
+	// number of armed timers
+	std::size_t count = 0;
+
+	clock::duration resolution;
+	clock::time_point epoch;
+
+	std::mutex mutex;
+
+	// the timer currently being fired by this thread (if any) - lets a timer cancel itself from its own callback
+	static timer *&firing_now() noexcept
+	{
+		static thread_local timer *t = nullptr;
+		return t;
+	}
+
+	static unsigned lowest_bit(std::uint64_t v) noexcept
+	{
+		unsigned i = 0;
+		for (; !(v & 1); v >>= 1) ++i;
+		return i;
+	}
+
+	// links an armed timer into the right slot for its expiry relative to the next unprocessed tick.
+	// WARNING - must hold the lock.
+	void place(timer *t) noexcept
+	{
+		const std::uint64_t base = current + 1;
+
+		// never place anything in the past, or beyond the current top-level block (those get re-placed when they come up)
+		std::uint64_t p = t->expiry;
+		if (p < base) p = base;
+		if (p > (base | (span(levels) - 1))) p = base | (span(levels) - 1);
+
+		// the lowest level at which p and base are in the same parent block
+		unsigned l = 0;
+		while ((p >> (bits * (l + 1))) != (base >> (bits * (l + 1)))) ++l;
+		const unsigned s = (p >> (bits * l)) & (slots - 1);
+
+		t->level = (unsigned char)l;
+		t->slot = (unsigned char)s;
+		t->prev = nullptr;
+		t->next = wheel[l][s];
+		if (t->next) t->next->prev = t;
+		wheel[l][s] = t;
+		occupied[l] |= std::uint64_t(1) << s;
+	}
+
+	// unlinks an armed timer from its slot.
+	// WARNING - must hold the lock.
+	void unlink(timer *t) noexcept
+	{
+		if (t->prev) t->prev->next = t->next;
+		else if (!(wheel[t->level][t->slot] = t->next)) occupied[t->level] &= ~(std::uint64_t(1) << t->slot);
+		if (t->next) t->next->prev = t->prev;
+	}
+
+	// detaches and returns the whole list in a slot.
+	// WARNING - must hold the lock.
+	timer *take(unsigned l, unsigned s) noexcept
+	{
+		timer *list = wheel[l][s];
+		wheel[l][s] = nullptr;
+		occupied[l] &= ~(std::uint64_t(1) << s);
+		return list;
+	}
+
+	// finds the first tick >= t at which something has to happen (a slot firing or cascading).
+	// returns false if there is nothing in the wheel at all.
+	// WARNING - must hold the lock.
+	bool next_event(std::uint64_t t, std::uint64_t &best) const noexcept
+	{
+		bool found = false;
+		for (unsigned l = 0; l < levels; ++l)
+		{
+			const std::uint64_t block = t & ~(span(l + 1) - 1);
+			const std::uint64_t first = (t - block + span(l) - 1) >> (bits * l);
+			if (first >= slots) continue;
+
+			const std::uint64_t mask = occupied[l] & (~std::uint64_t(0) << first);
+			if (!mask) continue;
+
+			const std::uint64_t tick = block + lowest_bit(mask) * span(l);
+			if (!found || tick < best) best = tick;
+			found = true;
+		}
+		return found;
+	}
+
+	// processes a single tick, moving any timers that are due onto the end of the expired list.
+	// WARNING - must hold the lock.
+	void process(std::uint64_t t, timer *&expired_head, timer *&expired_tail) noexcept
+	{
+		current = t - 1;
+
+		// cascade higher levels down (top-down, so a cascade can feed the one below it)
+		for (unsigned l = levels - 1; l > 0; --l)
+		{
+			if (t & (span(l) - 1)) continue;
+			for (timer *n = take(l, (t >> (bits * l)) & (slots - 1)), *next; n; n = next)
+			{
+				next = n->next;
+				place(n);
+			}
+		}
+
+		current = t;
+		for (timer *n = take(0, t & (slots - 1)), *next; n; n = next)
+		{
+			next = n->next;
+			// timers past the end of the wheel's range were clamped - put them back for another lap
+			if (n->expiry > t) place(n);
+			else
+			{
+				--count;
+				n->state.store(firing, std::memory_order_relaxed);
+				n->next = nullptr;
+				if (expired_tail) expired_tail->next = n;
+				else expired_head = n;
+				expired_tail = n;
+			}
+		}
+	}
+
+public: // -- ctor / dtor / asgn -- //
+
+	// creates a timer wheel with the given tick resolution. time zero is now.
+	explicit timer_wheel(clock::duration res = std::chrono::milliseconds(1)) : resolution(res), epoch(clock::now()) {}
+
+	timer_wheel(const timer_wheel&) = delete;
+	timer_wheel &operator=(const timer_wheel&) = delete;
+
+public: // -- interface -- //
+
+	// converts a time point to a (deadline) tick, rounding up so that timers never fire early.
+	// ticks are counted from 1 - tick 0 is the (already processed) instant the wheel was created.
+	std::uint64_t to_tick(clock::time_point tp) const noexcept
+	{
+		if (tp <= epoch) return 1;
+		return std::uint64_t((tp - epoch + resolution - clock::duration(1)) / resolution) + 1;
+	}
+
+	// arms t to fire at the given deadline. if the deadline has already passed, it fires on the next advance().
+	// WARNING - t must not already be armed.
+	void arm(timer &t, clock::time_point deadline) noexcept
+	{
+		const std::uint64_t tick = to_tick(deadline);
+		std::lock_guard<std::mutex> lock(mutex);
+		t.expiry = tick;
+		t.state.store(armed_state, std::memory_order_relaxed);
+		place(&t);
+		++count;
+	}
+
+	// disarms t. returns true iff it was removed before it fired.
+	// if t is in the middle of firing on another thread, blocks until that finishes (so t is safe to destroy afterwards).
+	// a timer may cancel itself from its own callback (this returns false without blocking).
+	bool cancel(timer &t) noexcept
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			if (t.state.load(std::memory_order_acquire) == armed_state)
+			{
+				unlink(&t);
+				--count;
+				t.state.store(idle, std::memory_order_relaxed);
+				return true;
+			}
+		}
+		if (firing_now() != &t)
+		{
+			while (t.state.load(std::memory_order_acquire) == firing) std::this_thread::yield();
+		}
+		return false;
+	}
+
+	// fires every timer whose deadline is at or before now (in deadline order). returns the number of timers fired.
+	std::size_t advance(clock::time_point now = clock::now()) noexcept
+	{
+		const std::uint64_t target = now < epoch ? 0 : std::uint64_t((now - epoch) / resolution) + 1;
+
+		timer *head = nullptr, *tail = nullptr;
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			while (current < target)
+			{
+				// skip straight to the next tick that has anything in it
+				std::uint64_t t = 0;
+				if (!next_event(current + 1, t) || t > target)
+				{
+					current = target;
+					break;
+				}
+				process(t, head, tail);
+			}
+		}
+
+		std::size_t fired = 0;
+		for (timer *n = head, *next; n; n = next, ++fired)
+		{
+			next = n->next;
+			firing_now() = n;
+			n->fire(n);
+			firing_now() = nullptr;
+			// after this, the owner is free to destroy n
+			n->state.store(idle, std::memory_order_release);
+		}
+		return fired;
+	}
+
+	// returns the number of armed timers
+	std::size_t size() noexcept
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		return count;
+	}
+
+	// returns the tick resolution
+	clock::duration tick() const noexcept { return resolution; }
+};
+
+// -------------------------------------------------------------- //
+
+// timer_thread owns a timer_wheel and a thread that advances it once per tick, so deadlines fire on their own.
+// any timers still armed when the timer_thread is destroyed will never fire - destroy (or release) them first.
+class timer_thread
+{
+private: // -- data -- //
+
+	timer_wheel _wheel;
+
+	std::mutex mutex;
+	std::condition_variable cv;
+	bool stopping = false;
+
+	std::thread thread;
+
+public: // -- ctor / dtor / asgn -- //
+
+	explicit timer_thread(timer_wheel::clock::duration res = std::chrono::milliseconds(1)) : _wheel(res)
+	{
+		thread = std::thread([this]
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			while (!cv.wait_for(lock, _wheel.tick(), [this] { return stopping; }))
+			{
+				lock.unlock();
+				_wheel.advance();
+				lock.lock();
+			}
+		});
+	}
+	~timer_thread()
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			stopping = true;
+		}
+		cv.notify_all();
+		thread.join();
+	}
+
+	timer_thread(const timer_thread&) = delete;
+	timer_thread &operator=(const timer_thread&) = delete;
+
+public: // -- interface -- //
+
+	// the wheel driven by this thread (bind deadline_fate objects to this)
+	timer_wheel &wheel() noexcept { return _wheel; }
+	operator timer_wheel&() noexcept { return _wheel; }
+};
+
+// -------------------------------------------------------------- //
+
+// deadline_fate is a fate that also fires by itself if it hasn't been released (or invoked) by a deadline - a watchdog.
+// on expiry, the bound function is invoked by whichever thread advances the timer_wheel (e.g. a timer_thread).
+// otherwise it follows the usual fate contract: invoking it explicitly (or destroying it) cancels the deadline and invokes the function now.
+// release() cancels the deadline and abandons the function. arming and releasing are O(1).
+// invoking/releasing the deadline_fate itself is not threadsafe (just like fate), but racing against expiry on the wheel's thread is fine -
+// exactly one of them wins, and if expiry is in progress, release()/destruction waits for it to finish.
+// deadline_fate is neither copyable nor movable, since the wheel holds a pointer to it.
+template<typename T>
+class deadline_fate
+{
+private: // -- data -- //
+
+	struct node : timer_wheel::timer
+	{
+		fate<T> func;
+
+		template<typename J>
+		explicit node(J &&arg) : func(std::forward<J>(arg)) { fire = &on_expire; }
+
+		static void on_expire(timer_wheel::timer *self) noexcept { static_cast<node*>(self)->func(); }
+	};
+
+	timer_wheel *wheel;
+	node n;
+
+public: // -- ctor / dtor / asgn -- //
+
+	// creates a deadline_fate bound to the given function-like object that fires at the given time if not released first.
+	// the argument will be forwarded to the T constructor. on failure, nothing is armed and an exception is thrown.
+	template<typename J>
+	deadline_fate(timer_wheel &w, timer_wheel::clock::time_point deadline, J &&arg) : wheel(&w), n(std::forward<J>(arg))
+	{
+		wheel->arm(n, deadline);
+	}
+	// creates a deadline_fate bound to the given function-like object that fires after the given timeout if not released first.
+	template<typename J>
+	deadline_fate(timer_wheel &w, timer_wheel::clock::duration timeout, J &&arg) : deadline_fate(w, timer_wheel::clock::now() + timeout, std::forward<J>(arg)) {}
+
+	~deadline_fate() { (*this)(); }
+
+	deadline_fate(const deadline_fate&) = delete;
+	deadline_fate &operator=(const deadline_fate&) = delete;
+
+public: // -- utilities -- //
+
+	// cancels the deadline and triggers the stored function (if it hasn't already fired).
+	// if the function-like object throws an exception, it is caught and ignored.
+	// the resulting object is guaranteed to be empty after this.
+	void operator()() noexcept
+	{
+		wheel->cancel(n);
+		n.func();
+	}
+
+	// cancels the deadline and abandons the function (will no longer be executed)
+	void release() noexcept
+	{
+		wheel->cancel(n);
+		n.func.release();
+	}
+
+	// returns true iff the deadline is still pending (it has not fired, been invoked, or been released)
+	bool pending() const noexcept { return n.armed(); }
+
+	// returns true iff this object is still associated with a function object (not threadsafe with expiry)
+	explicit operator bool() const noexcept { return (bool)n.func; }
+	// returns true iff this object is not associated with a function object (not threadsafe with expiry)
+	bool operator!() const noexcept { return !n.func; }
+
+	// returns true iff this object is not associated with a function object (not threadsafe with expiry)
+	bool empty() const noexcept { return n.func.empty(); }
+};
+
+// creates a deadline_fate from the given function-like object that fires at (or after) the given deadline/timeout.
+// deadline_fate can't be moved, so this relies on guaranteed copy elision - bind the result directly.
+template<typename D, typename T>
+deadline_fate<std::decay_t<T>> make_deadline_fate(timer_wheel &w, D deadline, T &&arg) { return deadline_fate<std::decay_t<T>>(w, deadline, std::forward<T>(arg)); }
+
+#endif
@@ -0,0 +1,468 @@
+#ifndef DRAGAZO_DURABLE_FATE_JOURNAL_H
+#define DRAGAZO_DURABLE_FATE_JOURNAL_H
+
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include <algorithm>
+#include <type_traits>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "fate.h"
+
+// durable_fate_journal is a crash-consistent, append-only log of cleanup obligations, backed by a memory-mapped file (posix only).
+// an obligation is an opaque payload (e.g. the path of a temp file) that is logged when it is armed and tombstoned once it's been completed or released.
+// obligations that were never tombstoned (because of kill -9, a crash, or power loss) are handed back by recover() on the next start,
+// so recovery costs time proportional to the journal (i.e. to the outstanding obligations), not to the amount of data they guard.
+// every record carries a checksum, and replay stops at the first torn or corrupt record (everything before it is intact, since the log is append-only).
+// durability is batched: arm() syncs by default (the obligation must be on disk before the resource it guards exists), but several arms can be grouped
+// under a single sync(), and tombstones are never synced on their own - they ride along with the next sync (or the close).
+// a lost tombstone just means the cleanup is replayed again, so cleanups must be idempotent (removing an already-removed file, etc.).
+// when the file fills up, it is compacted: the live records are copied into a fresh file, which atomically replaces the old one via rename().
+// all member functions are threadsafe.
+class durable_fate_journal
+{
+private: // -- data -- //
+
+	static constexpr std::uint64_t magic = 0x314c4e524a455446; // "FTEJRNL1"
+
+	struct file_header
+	{
+		std::uint64_t magic;
+		std::uint64_t reserved;
+	};
+
+	enum : std::uint32_t { kind_arm = 1, kind_tombstone = 2 };
+
+	// every record starts with this, followed by size bytes of payload, padded to a multiple of 8 bytes.
+	// a kind of 0 marks the end of the log (the rest of the file is zero-filled).
+	struct record_header
+	{
+		std::uint32_t checksum;
+		std::uint32_t kind;
+		std::uint64_t id;
+		std::uint32_t size;
+		std::uint32_t reserved;
+	};
+
+	static constexpr std::size_t align_up(std::size_t n) noexcept { return (n + 7) & ~(std::size_t)7; }
+	static constexpr std::size_t record_size(std::size_t payload) noexcept { return sizeof(record_header) + align_up(payload); }
+
+	// 32-bit fnv-1a over the record's kind, id and payload
+	static std::uint32_t checksum(std::uint32_t kind, std::uint64_t id, const void *payload, std::size_t size) noexcept
+	{
+		std::uint32_t h = 2166136261u;
+		auto mix = [&](const void *data, std::size_t n)
+		{
+			for (const unsigned char *p = (const unsigned char*)data, *end = p + n; p != end; ++p) h = (h ^ *p) * 16777619u;
+		};
+		mix(&kind, sizeof(kind));
+		mix(&id, sizeof(id));
+		mix(payload, size);
+		// never 0, so a zero-filled header can't pass as a record
+		return h ? h : 1;
+	}
+
+	mutable std::mutex mutex;
+
+	std::string path;
+	int fd = -1;
+	unsigned char *base = nullptr;
+	std::size_t capacity = 0;
+
+	// offset one past the last record, and how much of the log is known to be on disk
+	std::size_t tail = 0;
+	std::size_t synced = 0;
+
+	std::uint64_t next_id = 1;
+
+	// live obligations: id -> offset of their arm record
+	std::unordered_map<std::uint64_t, std::size_t> live;
+
+	[[noreturn]] static void fail(const char *what) { throw std::system_error(errno, std::generic_category(), what); }
+
+	void unmap() noexcept
+	{
+		if (base) ::munmap(base, capacity);
+		if (fd >= 0) ::close(fd);
+		base = nullptr;
+		fd = -1;
+	}
+
+	// opens (creating if needed) and maps the file at p. a new (empty) file is sized to new_size - existing files keep their size.
+	// returns the fd, mapping and size through the out params.
+	static void map_file(const std::string &p, std::size_t new_size, int &out_fd, unsigned char *&out_base, std::size_t &out_size)
+	{
+		int f = ::open(p.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+		if (f < 0) fail("durable_fate_journal: open");
+
+		struct stat st;
+		if (::fstat(f, &st) != 0) { ::close(f); fail("durable_fate_journal: fstat"); }
+		std::size_t size = (std::size_t)st.st_size;
+		const std::size_t want = std::max(size == 0 ? new_size : size, (std::size_t)4096);
+		if (size < want)
+		{
+			if (::ftruncate(f, (off_t)want) != 0 || ::fsync(f) != 0) { ::close(f); fail("durable_fate_journal: ftruncate"); }
+			size = want;
+		}
+
+		void *m = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, f, 0);
+		if (m == MAP_FAILED) { ::close(f); fail("durable_fate_journal: mmap"); }
+
+		out_fd = f;
+		out_base = (unsigned char*)m;
+		out_size = size;
+	}
+
+	// flushes [from, to) of the mapping to disk
+	void flush(std::size_t from, std::size_t to)
+	{
+		if (from >= to) return;
+		const std::size_t page = (std::size_t)::sysconf(_SC_PAGESIZE);
+		from -= from % page;
+		if (::msync(base + from, to - from, MS_SYNC) != 0) fail("durable_fate_journal: msync");
+	}
+
+	// scans the log, rebuilding the live set. returns true iff the file is clean past the end of the log (and doesn't need to be rewritten).
+	// throws std::runtime_error if the file isn't a journal.
+	bool replay()
+	{
+		file_header &fh = *(file_header*)base;
+		if (fh.magic != magic)
+		{
+			// refuse to clobber something that isn't ours
+			if (fh.magic != 0) throw std::runtime_error("durable_fate_journal: not a journal file");
+
+			// a new (zero-filled) file
+			fh.magic = magic;
+			tail = sizeof(file_header);
+			return false;
+		}
+
+		std::size_t pos = sizeof(file_header);
+		while (pos + sizeof(record_header) <= capacity)
+		{
+			record_header rh;
+			std::memcpy(&rh, base + pos, sizeof(rh));
+			if (rh.kind != kind_arm && rh.kind != kind_tombstone) break;
+			if (rh.size > capacity - pos || record_size(rh.size) > capacity - pos) break;
+			if (rh.checksum != checksum(rh.kind, rh.id, base + pos + sizeof(record_header), rh.size)) break;
+
+			if (rh.kind == kind_arm) live[rh.id] = pos;
+			else live.erase(rh.id);
+			next_id = std::max(next_id, rh.id + 1);
+
+			pos += record_size(rh.size);
+		}
+		tail = pos;
+
+		// anything non-zero past the end is a torn or stale tail, which must not be mistaken for records once we append over it
+		for (std::size_t i = tail; i < capacity; ++i) if (base[i]) return false;
+		return true;
+	}
+
+	// appends a record. returns false if there's no room.
+	bool append(std::uint32_t kind, std::uint64_t id, const void *payload, std::size_t size) noexcept
+	{
+		const std::size_t need = record_size(size);
+		if (need > capacity - tail) return false;
+
+		record_header rh{ checksum(kind, id, payload, size), kind, id, (std::uint32_t)size, 0 };
+		// there's no ordering between the pages of a mapping on their way to disk - a torn record is caught by its checksum instead
+		std::memcpy(base + tail, &rh, sizeof(rh));
+		if (size) std::memcpy(base + tail + sizeof(rh), payload, size);
+		tail += need;
+		return true;
+	}
+
+	// rewrites the live records into a fresh file (with at least extra bytes of free space), which atomically replaces the current one
+	void compact(std::size_t extra)
+	{
+		std::vector<std::pair<std::size_t, std::uint64_t>> order; // (old offset, id) - keeps arm order
+		order.reserve(live.size());
+		std::size_t needed = sizeof(file_header) + extra;
+		for (auto &entry : live)
+		{
+			order.emplace_back(entry.second, entry.first);
+			needed += record_size(((record_header*)(base + entry.second))->size);
+		}
+		std::sort(order.begin(), order.end());
+
+		std::size_t new_capacity = capacity;
+		while (new_capacity < 2 * needed) new_capacity *= 2;
+
+		const std::string tmp = path + ".compact";
+		::unlink(tmp.c_str());
+		int new_fd;
+		unsigned char *new_base;
+		std::size_t new_size;
+		map_file(tmp, new_capacity, new_fd, new_base, new_size);
+
+		((file_header*)new_base)->magic = magic;
+		std::size_t pos = sizeof(file_header);
+		std::unordered_map<std::uint64_t, std::size_t> new_live;
+		for (auto &entry : order)
+		{
+			const std::size_t n = record_size(((record_header*)(base + entry.first))->size);
+			std::memcpy(new_base + pos, base + entry.first, n);
+			new_live.emplace(entry.second, pos);
+			pos += n;
+		}
+
+		if (::msync(new_base, new_size, MS_SYNC) != 0 || ::rename(tmp.c_str(), path.c_str()) != 0)
+		{
+			const int e = errno;
+			::munmap(new_base, new_size);
+			::close(new_fd);
+			::unlink(tmp.c_str());
+			errno = e;
+			fail("durable_fate_journal: compact");
+		}
+
+		// make the rename itself durable
+		const std::size_t slash = path.find_last_of('/');
+		const std::string dir = slash == std::string::npos ? "." : slash == 0 ? "/" : path.substr(0, slash);
+		int dir_fd = ::open(dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+		if (dir_fd >= 0)
+		{
+			::fsync(dir_fd);
+			::close(dir_fd);
+		}
+
+		unmap();
+		fd = new_fd;
+		base = new_base;
+		capacity = new_size;
+		tail = synced = pos;
+		live = std::move(new_live);
+	}
+
+	// appends a record, compacting first if it doesn't fit
+	void append_or_compact(std::uint32_t kind, std::uint64_t id, const void *payload, std::size_t size)
+	{
+		if (append(kind, id, payload, size)) return;
+		compact(record_size(size));
+		append(kind, id, payload, size);
+	}
+
+public: // -- ctor / dtor / asgn -- //
+
+	// opens the journal at the given path (creating it with the given initial size if it doesn't exist) and replays it.
+	// the outstanding obligations are then available through pending() and recover().
+	// throws std::system_error on failure.
+	explicit durable_fate_journal(std::string file, std::size_t initial_size = 1 << 20) : path(std::move(file))
+	{
+		map_file(path, initial_size, fd, base, capacity);
+		try
+		{
+			if (!replay()) compact(0);
+			synced = tail;
+		}
+		catch (...)
+		{
+			unmap();
+			throw;
+		}
+	}
+
+	// syncs any outstanding records and closes the journal (obligations that are still armed stay in the journal for the next start)
+	~durable_fate_journal()
+	{
+		try { flush(synced, tail); }
+		catch (...) {}
+		unmap();
+	}
+
+	durable_fate_journal(const durable_fate_journal&) = delete;
+	durable_fate_journal &operator=(const durable_fate_journal&) = delete;
+
+public: // -- interface -- //
+
+	// logs a new obligation with the given payload and returns its id.
+	// if sync_now is true (the default), the obligation is on disk when this returns - pass false to batch several arms under one sync().
+	// throws std::system_error on failure (in which case the obligation may or may not have been logged).
+	std::uint64_t arm(std::string_view payload, bool sync_now = true)
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		const std::uint64_t id = next_id++;
+		append_or_compact(kind_arm, id, payload.data(), payload.size());
+		live[id] = tail - record_size(payload.size());
+		if (sync_now)
+		{
+			flush(synced, tail);
+			synced = tail;
+		}
+		return id;
+	}
+
+	// tombstones an obligation (it has been completed or released, so it won't be recovered).
+	// the tombstone is not synced by itself - it becomes durable with the next sync() - so this is cheap.
+	// returns true iff the obligation was live. never throws - if the tombstone can't be logged, the obligation is simply replayed later.
+	bool complete(std::uint64_t id) noexcept
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		if (!live.erase(id)) return false;
+		if (!append(kind_tombstone, id, nullptr, 0))
+		{
+			// compaction drops the record anyway (it's no longer live)
+			try { compact(0); }
+			catch (...) {}
+		}
+		return true;
+	}
+
+	// makes everything logged so far durable. throws std::system_error on failure.
+	void sync()
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		flush(synced, tail);
+		synced = tail;
+	}
+
+	// returns the number of outstanding obligations
+	std::size_t pending() const
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		return live.size();
+	}
+
+	// passes every outstanding obligation to fn(id, payload) in the order they were armed, tombstoning each one once fn returns, then syncs.
+	// if fn throws, the exception is caught and ignored (and the obligation is still tombstoned - as with fate, a cleanup gets one shot).
+	// meant to be called once at startup, before anything new is armed. returns the number of obligations processed.
+	template<typename F>
+	std::size_t recover(F &&fn)
+	{
+		std::vector<std::pair<std::size_t, std::uint64_t>> order;
+		std::vector<std::pair<std::uint64_t, std::string>> items;
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			for (auto &entry : live) order.emplace_back(entry.second, entry.first);
+			std::sort(order.begin(), order.end());
+			for (auto &entry : order)
+			{
+				const record_header *rh = (const record_header*)(base + entry.first);
+				items.emplace_back(entry.second, std::string((const char*)(rh + 1), rh->size));
+			}
+		}
+		for (auto &item : items)
+		{
+			try { fn(item.first, std::string_view(item.second)); }
+			catch (...) {}
+			complete(item.first);
+		}
+		sync();
+		return items.size();
+	}
+};
+
+// durable_fate pairs a local fate with an obligation armed in a durable_fate_journal.
+// invoking it runs the local function and then tombstones the obligation, and release() abandons the function and tombstones the obligation.
+// if the process dies before either happens, the obligation is handed back by recover() on the next start instead.
+template<typename T>
+class durable_fate
+{
+private: // -- data -- //
+
+	durable_fate_journal *journal;
+	std::uint64_t id;
+	fate<T> func;
+
+public: // -- ctor / dtor / asgn -- //
+
+	// creates a durable_fate that is not associated with anything (empty)
+	durable_fate() noexcept : journal(nullptr), id(0) {}
+
+	// logs (and syncs) the payload in the journal and binds the local function (the argument will be forwarded to the T constructor).
+	// on failure, an exception is thrown.
+	template<typename J>
+	durable_fate(durable_fate_journal &j, std::string_view payload, J &&arg) : journal(&j), id(0), func(std::forward<J>(arg))
+	{
+		try { id = j.arm(payload); }
+		catch (...)
+		{
+			func.release();
+			throw;
+		}
+	}
+
+	~durable_fate() { (*this)(); }
+
+	durable_fate(const durable_fate&) = delete;
+	durable_fate &operator=(const durable_fate&) = delete;
+
+	// constructs a new durable_fate by transfering other's contract to the new instance
+	durable_fate(durable_fate &&other) noexcept(std::is_nothrow_move_constructible_v<fate<T>>) : journal(other.journal), id(other.id), func(std::move(other.func))
+	{
+		other.id = 0;
+	}
+	// if this instance currently holds a function, it is triggered. after this, other's contract is transfered to this instance.
+	// in the special case of self-assignment, does nothing.
+	durable_fate &operator=(durable_fate &&other) noexcept(std::is_nothrow_move_assignable_v<fate<T>>)
+	{
+		if (this != &other)
+		{
+			(*this)();
+			func = std::move(other.func);
+			journal = other.journal;
+			id = other.id;
+			other.id = 0;
+		}
+		return *this;
+	}
+
+public: // -- utilities -- //
+
+	// runs the local function (if any), then tombstones the obligation.
+	// if the function-like object throws an exception, it is caught and ignored.
+	// the resulting object is guaranteed to be empty after this.
+	void operator()() noexcept
+	{
+		if (id)
+		{
+			func();
+			journal->complete(id);
+			id = 0;
+		}
+	}
+
+	// abandons the function and tombstones the obligation (it won't be recovered either)
+	void release() noexcept
+	{
+		if (id)
+		{
+			func.release();
+			journal->complete(id);
+			id = 0;
+		}
+	}
+
+	// returns true iff this object is still associated with a function object
+	explicit operator bool() const noexcept { return id != 0; }
+	// returns true iff this object is not associated with a function object
+	bool operator!() const noexcept { return id == 0; }
+
+	// returns true iff this object is not associated with a function object
+	bool empty() const noexcept { return id == 0; }
+};
+
+// creates a durable_fate that logs payload in journal and binds the given function-like object locally
+template<typename T>
+durable_fate<std::decay_t<T>> make_durable_fate(durable_fate_journal &journal, std::string_view payload, T &&arg)
+{
+	return durable_fate<std::decay_t<T>>(journal, payload, std::forward<T>(arg));
+}
+
+#endif
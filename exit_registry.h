@@ -0,0 +1,176 @@
+#ifndef DRAGAZO_EXIT_REGISTRY_H
+#define DRAGAZO_EXIT_REGISTRY_H
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdlib>
+#include <utility>
+#include <type_traits>
+
+#include "fate.h"
+
+// how important a process-exit cleanup is
+enum class exit_priority
+{
+	// must run no matter how we exit (e.g. flushing a journal) - fast_exit() always runs these
+	must_run,
+	// runs on a normal exit, and on fast_exit() for as long as its time budget allows (e.g. sending a goodbye to peers)
+	best_effort,
+	// runs on a normal exit, but is pure waste on the way out (e.g. freeing caches the OS reclaims anyway) - never run by fast_exit()
+	skip_on_fast_exit,
+};
+
+// exit_registry is a process-wide set of fates, grouped by exit_priority, that are invoked at process exit.
+// registration is lock-free (one allocation plus a CAS push) and may be done from any thread at any time.
+// within a priority class, fates run in LIFO order (like atexit). the classes run in priority order (must_run first).
+// on a normal exit, everything runs when the registry's function-local static is destroyed (i.e. interleaved with other static destructors, like atexit).
+// fast_exit() runs the must_run class, then as much of the best_effort class as fits in a time budget (none by default),
+// and then terminates immediately via std::_Exit, skipping static destructors, atexit handlers and everything else.
+// as with fate, exceptions thrown by registered fates are caught and ignored.
+class exit_registry
+{
+private: // -- data -- //
+
+	struct node
+	{
+		node *next = nullptr;
+		// invokes (if run is true) or releases the stored fate, then deletes the node
+		void (*finish)(node *self, bool run) noexcept = nullptr;
+	};
+	template<typename T>
+	struct node_impl final : node
+	{
+		fate<T> func;
+
+		explicit node_impl(fate<T> &&f) : func(std::move(f)) { finish = &finish_node; }
+
+		static void finish_node(node *self, bool run) noexcept
+		{
+			node_impl *n = static_cast<node_impl*>(self);
+			if (!run) n->func.release();
+			delete n;
+		}
+	};
+
+	static constexpr std::size_t class_count = 3;
+
+	// one lock-free (treiber) stack per priority class
+	std::atomic<node*> stacks[class_count] = {};
+
+	// set once the registry has been torn down at exit - anything registered after that (e.g. by a later static destructor) runs immediately
+	std::atomic<bool> closed{false};
+
+	constexpr exit_registry() noexcept = default;
+
+	// runs or abandons one class until it's observed empty (including anything registered while it was running)
+	void finish_class(exit_priority p, bool run) noexcept
+	{
+		std::atomic<node*> &stack = stacks[(std::size_t)p];
+		// take the whole stack at once - concurrent registrations start a new one, which the next pass picks up
+		for (node *n; (n = stack.exchange(nullptr, std::memory_order_acquire)); )
+		{
+			for (node *next; n; n = next)
+			{
+				next = n->next;
+				n->finish(n, run);
+			}
+		}
+	}
+
+	// runs one class (LIFO) until it's empty or the deadline has passed. anything left over is abandoned where it is (only used on the way out).
+	void run_until(exit_priority p, std::chrono::steady_clock::time_point deadline) noexcept
+	{
+		std::atomic<node*> &stack = stacks[(std::size_t)p];
+		for (node *n; std::chrono::steady_clock::now() < deadline && (n = stack.exchange(nullptr, std::memory_order_acquire)); )
+		{
+			for (node *next; n; n = next)
+			{
+				if (std::chrono::steady_clock::now() >= deadline) return;
+				next = n->next;
+				n->finish(n, true);
+			}
+		}
+	}
+
+public: // -- ctor / dtor / asgn -- //
+
+	// normal exit: run everything
+	~exit_registry()
+	{
+		closed.store(true);
+		run_all();
+	}
+
+	exit_registry(const exit_registry&) = delete;
+	exit_registry &operator=(const exit_registry&) = delete;
+
+public: // -- interface -- //
+
+	// gets the process-wide registry
+	static exit_registry &instance() noexcept
+	{
+		static exit_registry r;
+		return r;
+	}
+
+	// registers a fate to be invoked at exit with the given priority (the fate is moved from).
+	// threadsafe and lock-free. on failure (out of memory), the fate is left untouched and an exception is thrown.
+	// if the process is already past the point where the registry runs, the fate is invoked immediately.
+	template<typename T>
+	void add(fate<T> &&f, exit_priority p = exit_priority::best_effort)
+	{
+		if (!f) return;
+		if (closed.load(std::memory_order_relaxed))
+		{
+			f();
+			return;
+		}
+		node *n = new node_impl<T>(std::move(f));
+		std::atomic<node*> &stack = stacks[(std::size_t)p];
+		n->next = stack.load(std::memory_order_relaxed);
+		while (!stack.compare_exchange_weak(n->next, n, std::memory_order_release, std::memory_order_relaxed)) {}
+	}
+
+	// runs (LIFO) everything currently registered with the given priority. threadsafe.
+	void run(exit_priority p) noexcept { finish_class(p, true); }
+
+	// runs every class in priority order. threadsafe.
+	void run_all() noexcept
+	{
+		for (std::size_t i = 0; i < class_count; ++i) finish_class((exit_priority)i, true);
+	}
+
+	// abandons everything currently registered with the given priority (none of it will be invoked). threadsafe.
+	void release(exit_priority p) noexcept { finish_class(p, false); }
+
+	// runs the must_run class, then the best_effort class until budget has elapsed (checked between fates, so one slow fate can overrun it),
+	// then terminates the process immediately with the given exit code (via std::_Exit).
+	// nothing else runs - not skip_on_fast_exit, not static destructors, not atexit handlers, and stdio buffers are not flushed
+	// (register a must_run fate if you need them flushed).
+	// this runs arbitrary code, so it is not async-signal-safe - call it from your shutdown path (e.g. a signal-watching thread), not from a signal handler.
+	[[noreturn]] void fast_exit(int code, std::chrono::steady_clock::duration budget = {}) noexcept
+	{
+		run(exit_priority::must_run);
+		run_until(exit_priority::best_effort, std::chrono::steady_clock::now() + budget);
+		std::_Exit(code);
+	}
+};
+
+// registers a fate object (which is moved from) with the process-wide exit_registry
+template<typename T>
+void at_process_exit(fate<T> &&f, exit_priority p = exit_priority::best_effort)
+{
+	exit_registry::instance().add(std::move(f), p);
+}
+// registers a function-like object with the process-wide exit_registry
+template<typename T>
+void at_process_exit(T &&arg, exit_priority p = exit_priority::best_effort)
+{
+	at_process_exit(make_fate(std::forward<T>(arg)), p);
+}
+
+// runs the must_run class of the process-wide exit_registry (and the best_effort class for up to budget), then terminates immediately with the given exit code
+[[noreturn]] inline void fast_exit(int code, std::chrono::steady_clock::duration budget = {}) noexcept { exit_registry::instance().fast_exit(code, budget); }
+
+#endif
@@ -4,6 +4,63 @@
 #include <utility>
 #include <type_traits>
 
+// optional per-call-site instrumentation (see fate_stats.h and fate_timing.h) - compiles to nothing unless DRAGAZO_FATE_STATS or DRAGAZO_FATE_TIMING is defined
+#if defined(DRAGAZO_FATE_STATS) || defined(DRAGAZO_FATE_TIMING)
+#include <source_location>
+#define DRAGAZO_FATE_SITE_MEMBER std::source_location site;
+#define DRAGAZO_FATE_SITE_PARAM , std::source_location _site = std::source_location::current()
+#define DRAGAZO_FATE_SITE_ARG , _site
+#define DRAGAZO_FATE_SITE_INIT , site(_site)
+#define DRAGAZO_FATE_SITE_ASSIGN(x) site = (x);
+#define DRAGAZO_FATE_SITE_FILE site.file_name()
+#define DRAGAZO_FATE_SITE_LINE site.line()
+#else
+#define DRAGAZO_FATE_SITE_MEMBER
+#define DRAGAZO_FATE_SITE_PARAM
+#define DRAGAZO_FATE_SITE_ARG
+#define DRAGAZO_FATE_SITE_INIT
+#define DRAGAZO_FATE_SITE_ASSIGN(x)
+#define DRAGAZO_FATE_SITE_FILE ((const char*)nullptr)
+#define DRAGAZO_FATE_SITE_LINE 0u
+#endif
+
+#ifdef DRAGAZO_FATE_STATS
+#include "fate_stats.h"
+#define DRAGAZO_FATE_RECORD(event) fate_stats::record(site, fate_event::event)
+#else
+#define DRAGAZO_FATE_RECORD(event) ((void)0)
+#endif
+
+// the site is copied before the call, since the function is allowed to destroy the fate that invoked it
+#ifdef DRAGAZO_FATE_TIMING
+#include "fate_timing.h"
+#define DRAGAZO_FATE_TIMING_BEGIN const std::uint64_t _t0 = fate_timing::begin(); const std::source_location _s0 = site;
+#define DRAGAZO_FATE_TIMING_END if (_t0) fate_timing::end(_s0, _t0);
+#else
+#define DRAGAZO_FATE_TIMING_BEGIN
+#define DRAGAZO_FATE_TIMING_END
+#endif
+
+// usdt probes fate:arm, fate:invoke and fate:release (args: fate address, callable size, site file, site line) and fate:transfer
+// (args: new address, old address, callable size, site file, site line) - see fate_sdt.h. the site is only known with DRAGAZO_FATE_STATS or DRAGAZO_FATE_TIMING.
+#ifdef DRAGAZO_FATE_SDT
+#include "fate_sdt.h"
+#endif
+#if defined(DRAGAZO_FATE_SDT) && DRAGAZO_SDT_AVAILABLE
+#define DRAGAZO_FATE_PROBE(name, size) do { if (!__builtin_is_constant_evaluated()) DRAGAZO_SDT_PROBE4(fate, name, this, (unsigned long)(size), DRAGAZO_FATE_SITE_FILE, DRAGAZO_FATE_SITE_LINE); } while (0)
+#define DRAGAZO_FATE_PROBE_TRANSFER(from, size) do { if (!__builtin_is_constant_evaluated()) DRAGAZO_SDT_PROBE5(fate, transfer, this, (from), (unsigned long)(size), DRAGAZO_FATE_SITE_FILE, DRAGAZO_FATE_SITE_LINE); } while (0)
+#else
+#define DRAGAZO_FATE_PROBE(name, size) ((void)0)
+#define DRAGAZO_FATE_PROBE_TRANSFER(from, size) ((void)0)
+#endif
+
+// try blocks are only allowed in constexpr functions as of C++20 - before that, the functions that need one (invoking a fate) just aren't constexpr
+#if __cpp_constexpr >= 201907L
+#define DRAGAZO_FATE_CONSTEXPR_TRY constexpr
+#else
+#define DRAGAZO_FATE_CONSTEXPR_TRY
+#endif
+
 // fate (function at the end) is a wrapper for any function-like object that takes no args.
 // a fate object is bound to a function-like object and forms a contract with it to invoke it exactly one time (unless explicitly told not to).
 // upon being invoked explicitly, the fate instance becomes "empty" and will no longer be attached to its function-like object.
@@ -24,6 +81,9 @@ private: // -- data -- //
 	// marks if func_buf currently holds a (constructed) function object.
 	bool has_func;
 
+	// where this fate was created (only with DRAGAZO_FATE_STATS or DRAGAZO_FATE_TIMING)
+	DRAGAZO_FATE_SITE_MEMBER
+
 private: // -- helpers -- //
 
 	// WARNING - assumes this object is currently empty.
@@ -48,8 +108,11 @@ private: // -- helpers -- //
 			new(&func_buf) T(std::move_if_noexcept(*(T*)&other.func_buf));
 			// only mark as having a func if that succeeded (so we don't call garbage on destruction)
 			has_func = true;
-			// empty other (also only if the move/copy succeeded)
-			other.release();
+			DRAGAZO_FATE_SITE_ASSIGN(other.site)
+			DRAGAZO_FATE_PROBE_TRANSFER(&other, sizeof(T));
+			// empty other (also only if the move/copy succeeded) - without counting it as a release
+			other.has_func = false;
+			(*(T*)&other.func_buf).~T();
 		}
 	}
 
@@ -63,12 +126,14 @@ public: // -- ctor / dtor / asgn -- //
 	// on success, a valid fate is made that binds the given function-like object.
 	// on failure, the created fate instance is guaranteed to be empty and an exception is thrown.
 	template<typename J>
-	constexpr explicit fate(J &&arg) noexcept(noexcept((T)std::forward<J>(arg))) : has_func(false)
+	constexpr explicit fate(J &&arg DRAGAZO_FATE_SITE_PARAM) noexcept(noexcept((T)std::forward<J>(arg))) : has_func(false) DRAGAZO_FATE_SITE_INIT
 	{
 		// construct the function object
 		new(&func_buf) T(std::forward<J>(arg));
 		// only mark as having a func if that succeeded (so we don't call garbage on destruction)
 		has_func = true;
+		DRAGAZO_FATE_RECORD(created);
+		DRAGAZO_FATE_PROBE(arm, sizeof(T));
 	}
 
 	~fate() { (*this)(); }
@@ -98,17 +163,21 @@ public: // -- utilities -- //
 	// triggers the fate object to call its stored function (if any).
 	// if the function-like object throws an exception, it is caught and ignored.
 	// the resulting fate object is guaranteed to be empty after this.
-	constexpr void operator()() noexcept
+	DRAGAZO_FATE_CONSTEXPR_TRY void operator()() noexcept
 	{
 		// if we have a function
 		if (has_func)
 		{
 			// mark that we're empty (so that if the function calls this function we don't call it multiple times)
 			has_func = false;
+			DRAGAZO_FATE_RECORD(invoked);
+			DRAGAZO_FATE_PROBE(invoke, sizeof(T));
+			DRAGAZO_FATE_TIMING_BEGIN
 
 			// attempt to call it
 			try { (*(T*)&func_buf)(); }
-			catch (...) {}
+			catch (...) { DRAGAZO_FATE_RECORD(swallowed); }
+			DRAGAZO_FATE_TIMING_END
 
 			// then destroy it
 			(*(T*)&func_buf).~T();
@@ -131,6 +200,8 @@ public: // -- utilities -- //
 		{
 			// mark that we don't have a function object and call its destructor
 			has_func = false;
+			DRAGAZO_FATE_RECORD(released);
+			DRAGAZO_FATE_PROBE(release, sizeof(T));
 			(*(T*)&func_buf).~T();
 		}
 	}
@@ -146,13 +217,23 @@ private: // -- data -- //
 	// at all times this shall either hold a valid function pointer or nullptr to signify no function (empty).
 	T(*func)();
 
+	// where this fate was created (only with DRAGAZO_FATE_STATS or DRAGAZO_FATE_TIMING)
+	DRAGAZO_FATE_SITE_MEMBER
+
 public: // -- ctor / dtor / asgn -- //
 
 	// creates a fate object that is not associated with a function object (empty)
 	constexpr fate() noexcept : func(nullptr) {}
 
 	// creates a fate object for the given function
-	constexpr explicit fate(T(*f)()) noexcept : func(f) {}
+	constexpr explicit fate(T(*f)() DRAGAZO_FATE_SITE_PARAM) noexcept : func(f) DRAGAZO_FATE_SITE_INIT
+	{
+		if (func)
+		{
+			DRAGAZO_FATE_RECORD(created);
+			DRAGAZO_FATE_PROBE(arm, sizeof(func));
+		}
+	}
 
 	~fate() { (*this)(); }
 
@@ -162,6 +243,8 @@ public: // -- ctor / dtor / asgn -- //
 	// constructs a new fate object by transfering other's contract to the new instance
 	constexpr fate(fate &&other) noexcept : func(other.func)
 	{
+		DRAGAZO_FATE_SITE_ASSIGN(other.site)
+		if (func) DRAGAZO_FATE_PROBE_TRANSFER(&other, sizeof(func));
 		other.func = nullptr;
 	}
 	// if this instance currently holds a function, it is triggered. after this, other's contract is transfered to this instance.
@@ -172,6 +255,8 @@ public: // -- ctor / dtor / asgn -- //
 		{
 			(*this)();
 			func = other.func;
+			DRAGAZO_FATE_SITE_ASSIGN(other.site)
+			if (func) DRAGAZO_FATE_PROBE_TRANSFER(&other, sizeof(func));
 			other.func = nullptr;
 		}
 		return *this;
@@ -182,7 +267,7 @@ public: // -- utilities -- //
 	// triggers the fate object to call its stored function (if any).
 	// if the function-like object throws an exception, it is caught and ignored.
 	// the resulting fate object is guaranteed to be empty after this.
-	constexpr void operator()() noexcept
+	DRAGAZO_FATE_CONSTEXPR_TRY void operator()() noexcept
 	{
 		// if we have a function
 		if (func)
@@ -190,13 +275,123 @@ public: // -- utilities -- //
 			// mark that we're empty (so that if the function calls this function we don't call it multiple times)
 			T(*_f)() = func;
 			func = nullptr;
+			DRAGAZO_FATE_RECORD(invoked);
+			DRAGAZO_FATE_PROBE(invoke, sizeof(func));
+			DRAGAZO_FATE_TIMING_BEGIN
 
 			// attempt to call it
 			try { _f(); }
-			catch (...) {}
+			catch (...) { DRAGAZO_FATE_RECORD(swallowed); }
+			DRAGAZO_FATE_TIMING_END
+		}
+	}
+
+	// returns true iff this fate object is still associated with a function object
+	constexpr explicit operator bool() const noexcept { return func; }
+	// returns true iff this fate object is not associated with a function object
+	constexpr bool operator!() const noexcept { return !func; }
+
+	// returns true iff this fate object is not associated with a function object
+	constexpr bool empty() const noexcept { return !func; }
+
+	// abandons the function (will no longer be executed at the end of fate's lifetime)
+	constexpr void release() noexcept
+	{
+		if (func)
+		{
+			DRAGAZO_FATE_RECORD(released);
+			DRAGAZO_FATE_PROBE(release, sizeof(func));
+		}
+		func = nullptr;
+	}
+};
+
+// specialization for C-style callbacks that take a context pointer (e.g. free, fclose, lib_destroy(ctx)).
+// this is just the two pointers (no flag - a null function means empty) and the function is called directly,
+// so it's as cheap as binding the pair by hand and can be relocated by copying its bits (e.g. in packed C-interop tables).
+template<typename T, typename C>
+class fate<T(*)(C*)>
+{
+private: // -- data -- //
+
+	// the function to call at the end of the fate object's lifetime, or nullptr to signify no function (empty)
+	T(*func)(C*);
+	// the context pointer to call it with
+	C *ctx;
+
+	// where this fate was created (only with DRAGAZO_FATE_STATS or DRAGAZO_FATE_TIMING)
+	DRAGAZO_FATE_SITE_MEMBER
+
+public: // -- ctor / dtor / asgn -- //
+
+	// creates a fate object that is not associated with a function object (empty)
+	constexpr fate() noexcept : func(nullptr), ctx(nullptr) {}
+
+	// creates a fate object that will call f(c)
+	constexpr fate(T(*f)(C*), C *c DRAGAZO_FATE_SITE_PARAM) noexcept : func(f), ctx(c) DRAGAZO_FATE_SITE_INIT
+	{
+		if (func)
+		{
+			DRAGAZO_FATE_RECORD(created);
+			DRAGAZO_FATE_PROBE(arm, sizeof(func) + sizeof(ctx));
 		}
 	}
 
+	~fate() { (*this)(); }
+
+	fate(const fate&) = delete;
+	fate &operator=(const fate&) = delete;
+
+	// constructs a new fate object by transfering other's contract to the new instance
+	constexpr fate(fate &&other) noexcept : func(other.func), ctx(other.ctx)
+	{
+		DRAGAZO_FATE_SITE_ASSIGN(other.site)
+		if (func) DRAGAZO_FATE_PROBE_TRANSFER(&other, sizeof(func) + sizeof(ctx));
+		other.func = nullptr;
+	}
+	// if this instance currently holds a function, it is triggered. after this, other's contract is transfered to this instance.
+	// in the special case of self-assignment, does nothing.
+	constexpr fate &operator=(fate &&other) noexcept
+	{
+		if (this != &other)
+		{
+			(*this)();
+			func = other.func;
+			ctx = other.ctx;
+			DRAGAZO_FATE_SITE_ASSIGN(other.site)
+			if (func) DRAGAZO_FATE_PROBE_TRANSFER(&other, sizeof(func) + sizeof(ctx));
+			other.func = nullptr;
+		}
+		return *this;
+	}
+
+public: // -- utilities -- //
+
+	// triggers the fate object to call its stored function (if any) with its context pointer.
+	// if the function throws an exception, it is caught and ignored.
+	// the resulting fate object is guaranteed to be empty after this.
+	DRAGAZO_FATE_CONSTEXPR_TRY void operator()() noexcept
+	{
+		// if we have a function
+		if (func)
+		{
+			// mark that we're empty (so that if the function calls this function we don't call it multiple times)
+			T(*_f)(C*) = func;
+			func = nullptr;
+			DRAGAZO_FATE_RECORD(invoked);
+			DRAGAZO_FATE_PROBE(invoke, sizeof(func) + sizeof(ctx));
+			DRAGAZO_FATE_TIMING_BEGIN
+
+			// attempt to call it
+			try { _f(ctx); }
+			catch (...) { DRAGAZO_FATE_RECORD(swallowed); }
+			DRAGAZO_FATE_TIMING_END
+		}
+	}
+
+	// returns the context pointer the function will be called with
+	constexpr C *context() const noexcept { return ctx; }
+
 	// returns true iff this fate object is still associated with a function object
 	constexpr explicit operator bool() const noexcept { return func; }
 	// returns true iff this fate object is not associated with a function object
@@ -206,7 +401,15 @@ public: // -- utilities -- //
 	constexpr bool empty() const noexcept { return !func; }
 
 	// abandons the function (will no longer be executed at the end of fate's lifetime)
-	constexpr void release() noexcept { func = nullptr; }
+	constexpr void release() noexcept
+	{
+		if (func)
+		{
+			DRAGAZO_FATE_RECORD(released);
+			DRAGAZO_FATE_PROBE(release, sizeof(func) + sizeof(ctx));
+		}
+		func = nullptr;
+	}
 };
 
 // -------------------------------------------------------------- //
@@ -214,6 +417,10 @@ public: // -- utilities -- //
 // creates a fate object from the given function-like object.
 // effectively just a means of template class type deduction without needing C++17.
 template<typename T>
-constexpr auto make_fate(T &&arg) { return fate<std::decay_t<T>>{std::forward<T>(arg)}; }
+constexpr auto make_fate(T &&arg DRAGAZO_FATE_SITE_PARAM) { return fate<std::decay_t<T>>{std::forward<T>(arg) DRAGAZO_FATE_SITE_ARG}; }
+
+// creates a fate object that will call f(ctx) (ctx is converted to f's parameter type, so e.g. make_fate(free, p) works for any object pointer p)
+template<typename T, typename C, typename X>
+constexpr fate<T(*)(C*)> make_fate(T(*f)(C*), X *ctx DRAGAZO_FATE_SITE_PARAM) noexcept { return fate<T(*)(C*)>{f, ctx DRAGAZO_FATE_SITE_ARG}; }
 
 #endif
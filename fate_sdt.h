@@ -0,0 +1,67 @@
+#ifndef DRAGAZO_FATE_SDT_H
+#define DRAGAZO_FATE_SDT_H
+
+#include <type_traits>
+
+// a vendored subset of systemtap's <sys/sdt.h> (so there is no dependency on it): statically defined tracing (usdt) probes.
+// a probe is a single nop instruction plus an entry in the .note.stapsdt elf section that tells tracers (bpftrace, perf, systemtap, bcc)
+// where the nop is and where to find the probe's arguments (a register, an immediate or a stack slot) at that point.
+// when no tracer is attached the nop is all that runs - the arguments are just values the compiler already had in hand.
+// attaching a tracer patches the nop with a breakpoint, e.g.
+//     bpftrace -e 'usdt:./server:fate:invoke { @[str(arg2), arg3] = count(); }'
+// probes are only emitted for gcc/clang on 64-bit elf targets (x86-64 and aarch64). elsewhere DRAGAZO_SDT_AVAILABLE is 0 and the macros expand to nothing.
+// the probes use inline asm, so in constexpr functions they need C++20 (and are skipped during constant evaluation).
+
+#if (defined(__GNUC__) || defined(__clang__)) && defined(__ELF__) && (defined(__x86_64__) || defined(__aarch64__))
+#define DRAGAZO_SDT_AVAILABLE 1
+#else
+#define DRAGAZO_SDT_AVAILABLE 0
+#endif
+
+#if DRAGAZO_SDT_AVAILABLE
+
+// size of an argument for the note (negative for signed types, which is what the %n operand modifier below prints for a positive value)
+#define DRAGAZO_SDT_SIZE(x) ((std::is_signed_v<std::decay_t<decltype(x)>> ? 1 : -1) * (int)sizeof(x))
+#define DRAGAZO_SDT_ARG(n, x) [_sdt_s##n] "n" (DRAGAZO_SDT_SIZE(x)), [_sdt_a##n] "nor" (x)
+#define DRAGAZO_SDT_FMT(n) "%n[_sdt_s" #n "]@%[_sdt_a" #n "]"
+
+// the probe site and its note (the layout is the one defined by systemtap - version 3 notes)
+#define DRAGAZO_SDT_ASM(provider, name, fmt) \
+	"990: nop\n" \
+	".pushsection .note.stapsdt,\"?\",\"note\"\n" \
+	".balign 4\n" \
+	".4byte 992f-991f, 994f-993f, 3\n" \
+	"991: .asciz \"stapsdt\"\n" \
+	"992: .balign 4\n" \
+	"993: .8byte 990b\n" \
+	".8byte _.stapsdt.base\n" \
+	".8byte 0\n" \
+	".asciz \"" #provider "\"\n" \
+	".asciz \"" #name "\"\n" \
+	".asciz \"" fmt "\"\n" \
+	"994: .balign 4\n" \
+	".popsection\n" \
+	".ifndef _.stapsdt.base\n" \
+	".pushsection .stapsdt.base,\"aG\",\"progbits\",.stapsdt.base,comdat\n" \
+	".weak _.stapsdt.base\n" \
+	".hidden _.stapsdt.base\n" \
+	"_.stapsdt.base: .space 1\n" \
+	".size _.stapsdt.base, 1\n" \
+	".popsection\n" \
+	".endif\n"
+
+#define DRAGAZO_SDT_PROBE4(provider, name, a1, a2, a3, a4) \
+	__asm__ __volatile__(DRAGAZO_SDT_ASM(provider, name, DRAGAZO_SDT_FMT(1) " " DRAGAZO_SDT_FMT(2) " " DRAGAZO_SDT_FMT(3) " " DRAGAZO_SDT_FMT(4)) \
+		:: DRAGAZO_SDT_ARG(1, a1), DRAGAZO_SDT_ARG(2, a2), DRAGAZO_SDT_ARG(3, a3), DRAGAZO_SDT_ARG(4, a4))
+#define DRAGAZO_SDT_PROBE5(provider, name, a1, a2, a3, a4, a5) \
+	__asm__ __volatile__(DRAGAZO_SDT_ASM(provider, name, DRAGAZO_SDT_FMT(1) " " DRAGAZO_SDT_FMT(2) " " DRAGAZO_SDT_FMT(3) " " DRAGAZO_SDT_FMT(4) " " DRAGAZO_SDT_FMT(5)) \
+		:: DRAGAZO_SDT_ARG(1, a1), DRAGAZO_SDT_ARG(2, a2), DRAGAZO_SDT_ARG(3, a3), DRAGAZO_SDT_ARG(4, a4), DRAGAZO_SDT_ARG(5, a5))
+
+#else
+
+#define DRAGAZO_SDT_PROBE4(provider, name, a1, a2, a3, a4) ((void)0)
+#define DRAGAZO_SDT_PROBE5(provider, name, a1, a2, a3, a4, a5) ((void)0)
+
+#endif
+
+#endif
@@ -0,0 +1,187 @@
+#ifndef DRAGAZO_FATE_SITE_REGISTRY_H
+#define DRAGAZO_FATE_SITE_REGISTRY_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <new>
+#include <source_location>
+#include <vector>
+#include <algorithm>
+
+// the per-thread call site tables behind fate_stats and fate_timing (requires C++20) - not meant to be used directly.
+// every thread gets its own shard: a fixed-size open addressing table of Capacity sites (keyed by source location), plus an overflow site for
+// when it's full. only the owning thread writes to its shard, so recording needs no locks and no atomic read-modify-writes.
+// shards are merged (under the registry's lock) when a snapshot is taken, and the shard of a thread that exits is folded into a retired total.
+// Payload is what's recorded per site. it must be default constructible and have a const member function merge_into(Merged&) that adds it to a merged site.
+// Merged is the merged record for one site. it must be default constructible and copyable, with file and function (std::string) and line and column members.
+// each instantiation has its own registry.
+template<typename Payload, typename Merged, std::size_t Capacity>
+class fate_site_registry
+{
+public: // -- types -- //
+
+	// one site's payload in one shard. readers only look at the payload once used is set.
+	struct slot
+	{
+		std::atomic<bool> used{false};
+		const char *file = nullptr;
+		const char *function = nullptr;
+		std::uint_least32_t line = 0;
+		std::uint_least32_t column = 0;
+		Payload data;
+	};
+
+	struct shard
+	{
+		slot slots[Capacity];
+		// shared by every site that didn't fit (merged as "<overflow>")
+		slot overflow;
+		shard *next = nullptr;
+		shard *prev = nullptr;
+	};
+
+private: // -- data -- //
+
+	// all live shards, plus the totals of threads that have exited
+	struct registry
+	{
+		std::mutex mutex;
+		shard *shards = nullptr;
+		std::vector<Merged> retired;
+	};
+	static registry &global() noexcept
+	{
+		static registry r;
+		return r;
+	}
+
+	// the calling thread's shard - registered on first use and retired when the thread exits.
+	// if the shard can't be allocated, the thread simply isn't recorded.
+	// registering also reserves room in the retired totals for every site the shard could hold (plus one each for the overflow site and merge_retired()),
+	// so that retiring it later doesn't have to grow the list. merging is still guarded, since the merged records themselves may allocate.
+	struct holder
+	{
+		shard *s;
+
+		holder() : s(new (std::nothrow) shard)
+		{
+			if (!s) return;
+			registry &r = global();
+			std::lock_guard<std::mutex> lock(r.mutex);
+			try { r.retired.reserve(r.retired.size() + Capacity + 2); }
+			catch (...) {}
+			s->next = r.shards;
+			if (r.shards) r.shards->prev = s;
+			r.shards = s;
+		}
+		~holder()
+		{
+			exited() = true;
+			if (!s) return;
+			registry &r = global();
+			{
+				std::lock_guard<std::mutex> lock(r.mutex);
+				if (s->prev) s->prev->next = s->next;
+				else r.shards = s->next;
+				if (s->next) s->next->prev = s->prev;
+				try { merge(r.retired, *s); }
+				catch (...) {}
+			}
+			delete s;
+		}
+	};
+
+	static std::size_t hash(const char *file, std::uint_least32_t line, std::uint_least32_t column) noexcept
+	{
+		std::size_t h = (std::size_t)(std::uintptr_t)file;
+		h ^= (std::size_t)line * 0x9e3779b97f4a7c15ull;
+		h ^= (std::size_t)column * 0xc2b2ae3d27d4eb4full;
+		return h ^ (h >> 29);
+	}
+
+	// adds a payload into a list of merged sites (matching by file name, line and column - not by pointer, since each translation unit has its own copy)
+	static void merge_slot(std::vector<Merged> &out, const Payload &data, const char *file, const char *function, std::uint_least32_t line, std::uint_least32_t column)
+	{
+		auto it = std::find_if(out.begin(), out.end(), [&](const Merged &m) { return m.line == line && m.column == column && m.file == file; });
+		if (it == out.end())
+		{
+			out.emplace_back();
+			it = out.end() - 1;
+			it->file = file;
+			it->function = function;
+			it->line = line;
+			it->column = column;
+		}
+		data.merge_into(*it);
+	}
+	static void merge(std::vector<Merged> &out, const shard &s)
+	{
+		for (const slot &e : s.slots)
+		{
+			if (e.used.load(std::memory_order_acquire)) merge_slot(out, e.data, e.file, e.function, e.line, e.column);
+		}
+		merge_slot(out, s.overflow.data, "<overflow>", "", 0, 0);
+	}
+
+public: // -- interface -- //
+
+	// returns true once the calling thread's shard has been retired (e.g. for a fate in a later thread_local destructor)
+	static bool &exited() noexcept
+	{
+		static thread_local bool e = false;
+		return e;
+	}
+
+	// returns the calling thread's shard (registering it on first use), or null if it has been retired or couldn't be allocated
+	static shard *local() noexcept
+	{
+		if (exited()) return nullptr;
+		static thread_local holder h;
+		return h.s;
+	}
+
+	// finds (or claims) the payload for the given site in a shard owned by the calling thread. returns null if the shard is full.
+	static Payload *find(shard &s, const std::source_location &site) noexcept
+	{
+		const char *file = site.file_name();
+		const std::uint_least32_t line = site.line(), column = site.column();
+		for (std::size_t i = hash(file, line, column) % Capacity, n = 0; n < Capacity; i = (i + 1) % Capacity, ++n)
+		{
+			slot &e = s.slots[i];
+			if (!e.used.load(std::memory_order_relaxed))
+			{
+				e.file = file;
+				e.function = site.function_name();
+				e.line = line;
+				e.column = column;
+				e.used.store(true, std::memory_order_release);
+				return &e.data;
+			}
+			if (e.file == file && e.line == line && e.column == column) return &e.data;
+		}
+		return nullptr;
+	}
+
+	// merges a payload for the given site straight into the retired totals (for threads that are past their shard). throws on failure.
+	static void merge_retired(const std::source_location &site, const Payload &data)
+	{
+		registry &r = global();
+		std::lock_guard<std::mutex> lock(r.mutex);
+		merge_slot(r.retired, data, site.file_name(), site.function_name(), site.line(), site.column());
+	}
+
+	// merges every shard (live and retired) into per-site records. sites are listed in no particular order.
+	// payloads from other threads are read on the fly, so a snapshot taken while they are busy may lag slightly behind.
+	static std::vector<Merged> snapshot()
+	{
+		registry &r = global();
+		std::lock_guard<std::mutex> lock(r.mutex);
+		std::vector<Merged> out = r.retired;
+		for (const shard *s = r.shards; s; s = s->next) merge(out, *s);
+		return out;
+	}
+};
+
+#endif
@@ -0,0 +1,121 @@
+#ifndef DRAGAZO_FATE_STATS_H
+#define DRAGAZO_FATE_STATS_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+#include <source_location>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+#include "fate_site_registry.h"
+
+// per-call-site fate counters (opt-in, requires C++20).
+// define DRAGAZO_FATE_STATS (for the whole program) before including fate.h to turn them on: every fate then remembers the std::source_location
+// it was created at (make_fate's caller, or the constructor's), and counts how often fates from that site are created, invoked, released,
+// and how many exceptions their functions threw (which fate swallows).
+// without DRAGAZO_FATE_STATS, none of this is compiled into fate at all (fate doesn't even include this header), so it can stay in production code.
+// counting is done in a per-thread shard (see fate_site_registry.h - no locks, no atomic read-modify-writes), and the shards are only
+// merged when a snapshot is taken. the shard of a thread that exits is folded into a retired total, so nothing is lost.
+// a shard has room for DRAGAZO_FATE_STATS_SITES sites (default 1024, at about 64 bytes per site) - anything beyond that is counted under an "<overflow>" site.
+
+#ifndef DRAGAZO_FATE_STATS_SITES
+#define DRAGAZO_FATE_STATS_SITES 1024
+#endif
+
+// the things fate_stats counts
+enum class fate_event
+{
+	created,  // a fate was bound to a function
+	invoked,  // a fate invoked its function
+	released, // a fate abandoned its function
+	swallowed, // a fate's function threw an exception (which was caught and ignored)
+};
+
+// merged counts for one call site
+struct fate_site_stats
+{
+	std::string file;
+	std::string function;
+	std::uint_least32_t line = 0;
+	std::uint_least32_t column = 0;
+
+	std::uint64_t created = 0;
+	std::uint64_t invoked = 0;
+	std::uint64_t released = 0;
+	std::uint64_t swallowed = 0;
+};
+
+class fate_stats
+{
+private: // -- data -- //
+
+	static constexpr std::size_t event_count = 4;
+
+	// one site's counters in one shard. only the owning thread writes (so plain load + store is enough), snapshots read concurrently.
+	struct counters
+	{
+		std::atomic<std::uint64_t> counts[event_count] = {};
+
+		void merge_into(fate_site_stats &s) const noexcept
+		{
+			s.created += counts[0].load(std::memory_order_relaxed);
+			s.invoked += counts[1].load(std::memory_order_relaxed);
+			s.released += counts[2].load(std::memory_order_relaxed);
+			s.swallowed += counts[3].load(std::memory_order_relaxed);
+		}
+	};
+
+	typedef fate_site_registry<counters, fate_site_stats, DRAGAZO_FATE_STATS_SITES> registry;
+
+public: // -- interface -- //
+
+	// counts an event for the given call site on the calling thread's shard. this is what fate calls.
+	static void record(const std::source_location &site, fate_event event) noexcept
+	{
+		if (registry::exited())
+		{
+			// the thread is past its shard's destruction (e.g. a fate in a later thread_local destructor) - count it straight into the retired totals
+			try
+			{
+				counters tmp;
+				tmp.counts[(std::size_t)event].store(1, std::memory_order_relaxed);
+				registry::merge_retired(site, tmp);
+			}
+			catch (...) {}
+			return;
+		}
+
+		registry::shard *s = registry::local();
+		if (!s) return;
+		counters *e = registry::find(*s, site);
+		std::atomic<std::uint64_t> &c = (e ? *e : s->overflow.data).counts[(std::size_t)event];
+		c.store(c.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+	}
+
+	// merges every shard (live and retired) into per-site totals. sites are listed in no particular order.
+	// counts from other threads are read on the fly, so a snapshot taken while they are busy may lag slightly behind.
+	static std::vector<fate_site_stats> snapshot()
+	{
+		std::vector<fate_site_stats> out = registry::snapshot();
+		out.erase(std::remove_if(out.begin(), out.end(), [](const fate_site_stats &s) { return !s.created && !s.invoked && !s.released && !s.swallowed; }), out.end());
+		return out;
+	}
+
+	// writes a snapshot as a table (one site per line, busiest first)
+	static void dump(std::ostream &os)
+	{
+		std::vector<fate_site_stats> sites = snapshot();
+		std::sort(sites.begin(), sites.end(), [](const fate_site_stats &a, const fate_site_stats &b) { return a.created > b.created; });
+		os << "created\tinvoked\treleased\tswallowed\tsite\n";
+		for (const fate_site_stats &s : sites)
+		{
+			os << s.created << '\t' << s.invoked << '\t' << s.released << '\t' << s.swallowed << '\t'
+				<< s.file << ':' << s.line << ':' << s.column << " (" << s.function << ")\n";
+		}
+	}
+};
+
+#endif
@@ -0,0 +1,244 @@
+#ifndef DRAGAZO_FATE_TIMING_H
+#define DRAGAZO_FATE_TIMING_H
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <ostream>
+#include <source_location>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+#include "fate_site_registry.h"
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#ifdef _MSC_VER
+#include <intrin.h>
+#else
+#include <x86intrin.h>
+#endif
+#define DRAGAZO_FATE_TIMING_TSC 1
+#endif
+
+// sampled per-call-site latency histograms for fate invocations (opt-in, requires C++20).
+// define DRAGAZO_FATE_TIMING (for the whole program) before including fate.h to turn them on: every fate then remembers the std::source_location
+// it was created at, and one in every sample_rate() invocations (per thread) is timed and recorded into a histogram for that site.
+// without DRAGAZO_FATE_TIMING, none of this is compiled into fate at all, so it can stay in production code.
+// timing uses the cycle counter (rdtsc) on x86 and std::chrono::steady_clock elsewhere - tsc readings are converted to nanoseconds when reporting.
+// histograms are log-linear (4 linear buckets per power of two, so any reported value is within 12.5% of the truth) and live in per-thread shards
+// written only by their thread (see fate_site_registry.h) - there are no locks or atomic read-modify-writes when recording. shards are merged when a snapshot is taken,
+// and the shard of a thread that exits is folded into a retired total.
+// a shard has room for DRAGAZO_FATE_TIMING_SITES sites (default 256) - invocations from sites beyond that are not timed.
+// a site's histogram (about 2KB) is only allocated once one of its invocations is actually sampled on that thread.
+
+#ifndef DRAGAZO_FATE_TIMING_SITES
+#define DRAGAZO_FATE_TIMING_SITES 256
+#endif
+
+// merged latency figures for one call site (in nanoseconds)
+struct fate_site_timing
+{
+	std::string file;
+	std::string function;
+	std::uint_least32_t line = 0;
+	std::uint_least32_t column = 0;
+
+	// number of sampled invocations
+	std::uint64_t samples = 0;
+
+	double p50 = 0;
+	double p90 = 0;
+	double p99 = 0;
+	double p999 = 0;
+	double max = 0;
+};
+
+class fate_timing
+{
+private: // -- data -- //
+
+	static constexpr std::size_t bucket_count = 4 + 62 * 4;
+
+	// log-linear bucket for a raw duration: values below 4 get their own bucket, then each power of two is split into 4
+	static std::size_t bucket_of(std::uint64_t v) noexcept
+	{
+		if (v < 4) return (std::size_t)v;
+		std::size_t e = 63;
+		while (!(v >> e)) --e;
+		return 4 + (e - 2) * 4 + (std::size_t)((v >> (e - 2)) & 3);
+	}
+	// the midpoint of a bucket (in raw units)
+	static double bucket_value(std::size_t b) noexcept
+	{
+		if (b < 4) return (double)b;
+		const std::size_t e = (b - 4) / 4 + 2, sub = (b - 4) % 4;
+		const double low = (double)((std::uint64_t)(4 + sub) << (e - 2));
+		return low + (double)((std::uint64_t)1 << (e - 2)) / 2;
+	}
+
+	struct histogram
+	{
+		std::atomic<std::uint64_t> counts[bucket_count] = {};
+	};
+
+	// merged histogram for one site (used while reporting, and for the retired totals)
+	struct merged
+	{
+		std::string file;
+		std::string function;
+		std::uint_least32_t line = 0;
+		std::uint_least32_t column = 0;
+		std::vector<std::uint64_t> counts = std::vector<std::uint64_t>(bucket_count);
+	};
+
+	// one site's histogram in one shard (allocated when it's first sampled). only the owning thread writes, snapshots read concurrently.
+	struct site_histogram
+	{
+		std::atomic<histogram*> hist{nullptr};
+
+		site_histogram() = default;
+		~site_histogram() { delete hist.load(std::memory_order_relaxed); }
+
+		site_histogram(const site_histogram&) = delete;
+		site_histogram &operator=(const site_histogram&) = delete;
+
+		void merge_into(merged &m) const noexcept
+		{
+			const histogram *h = hist.load(std::memory_order_acquire);
+			if (!h) return;
+			for (std::size_t b = 0; b < bucket_count; ++b) m.counts[b] += h->counts[b].load(std::memory_order_relaxed);
+		}
+	};
+
+	typedef fate_site_registry<site_histogram, merged, DRAGAZO_FATE_TIMING_SITES> registry;
+
+	// tsc calibration point (taken on first use) and the sample rate
+	struct settings
+	{
+		std::uint64_t raw_origin = now();
+		std::chrono::steady_clock::time_point clock_origin = std::chrono::steady_clock::now();
+
+		std::atomic<std::uint32_t> rate{64};
+	};
+	static settings &global() noexcept
+	{
+		static settings r;
+		return r;
+	}
+
+	// nanoseconds per raw clock unit
+	static double ns_per_unit() noexcept
+	{
+#ifdef DRAGAZO_FATE_TIMING_TSC
+		settings &r = global();
+		const std::uint64_t raw = now() - r.raw_origin;
+		const double ns = (double)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - r.clock_origin).count();
+		return raw ? ns / (double)raw : 1;
+#else
+		return 1;
+#endif
+	}
+
+public: // -- interface -- //
+
+	// reads the raw clock (tsc ticks on x86, steady_clock nanoseconds elsewhere)
+	static std::uint64_t now() noexcept
+	{
+#ifdef DRAGAZO_FATE_TIMING_TSC
+		return __rdtsc();
+#else
+		return (std::uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+	}
+
+	// sets how many invocations (per thread) there are per sample - 1 times every invocation. threadsafe.
+	static void set_sample_rate(std::uint32_t n) noexcept { global().rate.store(n ? n : 1, std::memory_order_relaxed); }
+	// returns how many invocations (per thread) there are per sample
+	static std::uint32_t sample_rate() noexcept { return global().rate.load(std::memory_order_relaxed); }
+
+	// called by fate before an invocation: returns a start time if this invocation is sampled, otherwise 0
+	static std::uint64_t begin() noexcept
+	{
+		static thread_local std::uint32_t countdown = 1;
+		if (!registry::local() || --countdown) return 0;
+		countdown = sample_rate();
+		const std::uint64_t t = now();
+		return t ? t : 1;
+	}
+	// called by fate after a sampled invocation
+	static void end(const std::source_location &site, std::uint64_t start) noexcept
+	{
+		const std::uint64_t elapsed = now() - start;
+		registry::shard *s = registry::local();
+		if (!s) return;
+		site_histogram *e = registry::find(*s, site);
+		if (!e) return;
+
+		histogram *hist = e->hist.load(std::memory_order_relaxed);
+		if (!hist)
+		{
+			hist = new (std::nothrow) histogram;
+			if (!hist) return;
+			e->hist.store(hist, std::memory_order_release);
+		}
+		std::atomic<std::uint64_t> &c = hist->counts[bucket_of(elapsed)];
+		c.store(c.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+	}
+
+	// merges every shard (live and retired) and computes per-site percentiles (in nanoseconds). sites are listed in no particular order.
+	static std::vector<fate_site_timing> snapshot()
+	{
+		const std::vector<merged> sites = registry::snapshot();
+
+		const double scale = ns_per_unit();
+		std::vector<fate_site_timing> out;
+		for (const merged &m : sites)
+		{
+			fate_site_timing t;
+			t.file = m.file;
+			t.function = m.function;
+			t.line = m.line;
+			t.column = m.column;
+			for (std::uint64_t c : m.counts) t.samples += c;
+			if (!t.samples) continue;
+
+			// walks the buckets for the value at quantile q
+			auto at = [&](double q)
+			{
+				const std::uint64_t rank = (std::uint64_t)(q * (double)(t.samples - 1)) + 1;
+				std::uint64_t seen = 0;
+				for (std::size_t b = 0; b < bucket_count; ++b)
+				{
+					seen += m.counts[b];
+					if (seen >= rank) return bucket_value(b) * scale;
+				}
+				return 0.0;
+			};
+			t.p50 = at(0.5);
+			t.p90 = at(0.9);
+			t.p99 = at(0.99);
+			t.p999 = at(0.999);
+			t.max = at(1.0);
+			out.push_back(std::move(t));
+		}
+		return out;
+	}
+
+	// writes a snapshot as a table (one site per line, slowest p99 first)
+	static void dump(std::ostream &os)
+	{
+		std::vector<fate_site_timing> sites = snapshot();
+		std::sort(sites.begin(), sites.end(), [](const fate_site_timing &a, const fate_site_timing &b) { return a.p99 > b.p99; });
+		os << "samples\tp50(ns)\tp90(ns)\tp99(ns)\tp99.9(ns)\tmax(ns)\tsite\n";
+		for (const fate_site_timing &s : sites)
+		{
+			os << s.samples << '\t' << (std::uint64_t)s.p50 << '\t' << (std::uint64_t)s.p90 << '\t' << (std::uint64_t)s.p99 << '\t' << (std::uint64_t)s.p999 << '\t' << (std::uint64_t)s.max << '\t'
+				<< s.file << ':' << s.line << ':' << s.column << " (" << s.function << ")\n";
+		}
+	}
+};
+
+#endif
@@ -0,0 +1,410 @@
+#ifndef DRAGAZO_FATE_TRACE_H
+#define DRAGAZO_FATE_TRACE_H
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <mutex>
+#include <new>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "fate.h"
+
+// timeline tracing of guarded scopes, exported as chrome trace json (which chrome://tracing and the perfetto ui both open).
+// a zone is recorded as a single complete event (name, category, start, duration) when it ends, so a traced_fate can be moved between threads
+// without leaving unmatched begin/end pairs behind.
+// events go into a per-thread ring buffer of DRAGAZO_FATE_TRACE_EVENTS events (default 4096, 32 bytes each) - the only allocation is the buffer itself,
+// made the first time a thread records anything. recording takes no locks: the owning thread is the only producer and fate_trace::flush() is the only consumer.
+// if a buffer is full (nothing has flushed it recently), new events are dropped and counted (see fate_trace::dropped()), so memory stays capped.
+// names and categories are stored by pointer and must outlive the trace (i.e. use string literals).
+
+#ifndef DRAGAZO_FATE_TRACE_EVENTS
+#define DRAGAZO_FATE_TRACE_EVENTS 4096
+#endif
+
+class fate_trace
+{
+private: // -- data -- //
+
+	static constexpr std::size_t capacity = DRAGAZO_FATE_TRACE_EVENTS;
+	static_assert(capacity && !(capacity & (capacity - 1)), "DRAGAZO_FATE_TRACE_EVENTS must be a power of two");
+
+	struct event
+	{
+		const char *name;
+		const char *cat;
+		std::uint64_t start; // ns since the trace origin
+		std::uint64_t dur;   // ns
+	};
+
+	// a single-producer / single-consumer ring. the owning thread writes events and publishes them with head, flush() reads them and frees them with tail.
+	struct buffer
+	{
+		event events[capacity];
+		std::atomic<std::uint64_t> head{0};
+		std::atomic<std::uint64_t> tail{0};
+		std::uint32_t tid = 0;
+		buffer *next = nullptr;
+		buffer *prev = nullptr;
+	};
+
+	struct retired_event
+	{
+		std::uint32_t tid;
+		event e;
+	};
+
+	struct registry
+	{
+		std::mutex mutex;
+		buffer *buffers = nullptr;
+		std::vector<retired_event> retired; // unflushed events of threads that have exited (at most capacity of them)
+		std::uint32_t next_tid = 1;
+
+		std::atomic<bool> enabled{true};
+		std::atomic<std::uint64_t> dropped{0};
+		std::chrono::steady_clock::time_point origin = std::chrono::steady_clock::now();
+	};
+	static registry &global() noexcept
+	{
+		static registry r;
+		return r;
+	}
+
+	// the calling thread's buffer - registered on first use. when the thread exits, its unflushed events are moved to the retired list.
+	// if the buffer can't be allocated, the thread's events are dropped.
+	struct holder
+	{
+		buffer *b;
+
+		holder() : b(new (std::nothrow) buffer)
+		{
+			if (!b) return;
+			registry &r = global();
+			std::lock_guard<std::mutex> lock(r.mutex);
+			b->tid = r.next_tid++;
+			b->next = r.buffers;
+			if (r.buffers) r.buffers->prev = b;
+			r.buffers = b;
+		}
+		~holder()
+		{
+			exited() = true;
+			if (!b) return;
+			registry &r = global();
+			{
+				std::lock_guard<std::mutex> lock(r.mutex);
+				if (b->prev) b->prev->next = b->next;
+				else r.buffers = b->next;
+				if (b->next) b->next->prev = b->prev;
+
+				const std::uint64_t head = b->head.load(std::memory_order_relaxed);
+				for (std::uint64_t i = b->tail.load(std::memory_order_relaxed); i != head; ++i)
+				{
+					if (r.retired.size() >= capacity) { r.dropped.fetch_add(head - i, std::memory_order_relaxed); break; }
+					try { r.retired.push_back({ b->tid, b->events[i % capacity] }); }
+					catch (...) { r.dropped.fetch_add(head - i, std::memory_order_relaxed); break; }
+				}
+			}
+			delete b;
+		}
+	};
+	static bool &exited() noexcept
+	{
+		static thread_local bool e = false;
+		return e;
+	}
+
+	static void write_event(std::ostream &os, std::uint32_t tid, const event &e)
+	{
+		os << "{\"name\":\"";
+		escape(os, e.name);
+		os << "\",\"cat\":\"";
+		escape(os, e.cat);
+		char nums[96];
+		std::snprintf(nums, sizeof(nums), "\",\"ph\":\"X\",\"pid\":1,\"tid\":%lu,\"ts\":%llu.%03u,\"dur\":%llu.%03u},\n", (unsigned long)tid,
+			(unsigned long long)(e.start / 1000), (unsigned)(e.start % 1000), (unsigned long long)(e.dur / 1000), (unsigned)(e.dur % 1000));
+		os << nums;
+	}
+	static void escape(std::ostream &os, const char *s)
+	{
+		for (; *s; ++s)
+		{
+			const unsigned char c = (unsigned char)*s;
+			if (c == '"' || c == '\\') os << '\\' << (char)c;
+			else if (c < 0x20)
+			{
+				char u[8];
+				std::snprintf(u, sizeof(u), "\\u%04x", (unsigned)c);
+				os << u;
+			}
+			else os << (char)c;
+		}
+	}
+
+public: // -- interface -- //
+
+	// returns the current trace time (nanoseconds since the trace origin)
+	static std::uint64_t now() noexcept
+	{
+		return (std::uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - global().origin).count();
+	}
+
+	// turns recording on or off (e.g. from a canary config flag). zones that start while recording is off are never recorded. threadsafe.
+	static void enable(bool on) noexcept { global().enabled.store(on, std::memory_order_relaxed); }
+	// returns true iff recording is on
+	static bool enabled() noexcept { return global().enabled.load(std::memory_order_relaxed); }
+
+	// returns the total number of events dropped because a buffer was full
+	static std::uint64_t dropped() noexcept { return global().dropped.load(std::memory_order_relaxed); }
+
+	// records a complete event on the calling thread's buffer (start and end are from now()). the event is dropped if the buffer is full.
+	static void record(const char *name, const char *cat, std::uint64_t start, std::uint64_t end) noexcept
+	{
+		registry &r = global();
+		if (exited()) { r.dropped.fetch_add(1, std::memory_order_relaxed); return; }
+		static thread_local holder h;
+		buffer *b = h.b;
+		if (!b) { r.dropped.fetch_add(1, std::memory_order_relaxed); return; }
+
+		const std::uint64_t head = b->head.load(std::memory_order_relaxed);
+		if (head - b->tail.load(std::memory_order_acquire) >= capacity) { r.dropped.fetch_add(1, std::memory_order_relaxed); return; }
+		b->events[head % capacity] = { name, cat, start, end - start };
+		b->head.store(head + 1, std::memory_order_release);
+	}
+
+	// drains every buffer (and the retired events), writing each event as a chrome trace json object followed by a comma and a newline.
+	// this is the json array format without its closing bracket, which the trace viewers accept - see fate_trace_file for a complete file.
+	// flushes are serialized with each other. they only block a thread recording its very first event (which registers its buffer). returns the number of events written.
+	static std::size_t flush(std::ostream &os)
+	{
+		registry &r = global();
+		std::lock_guard<std::mutex> lock(r.mutex);
+		std::size_t count = 0;
+
+		for (const retired_event &e : r.retired) write_event(os, e.tid, e.e);
+		count += r.retired.size();
+		r.retired.clear();
+
+		for (buffer *b = r.buffers; b; b = b->next)
+		{
+			const std::uint64_t head = b->head.load(std::memory_order_acquire);
+			std::uint64_t tail = b->tail.load(std::memory_order_relaxed);
+			for (; tail != head; ++tail, ++count) write_event(os, b->tid, b->events[tail % capacity]);
+			b->tail.store(tail, std::memory_order_release);
+		}
+		return count;
+	}
+};
+
+// records a zone covering its own lifetime (e.g. a block or a whole function)
+class trace_zone
+{
+private: // -- data -- //
+
+	const char *name; // null if not recording
+	const char *cat;
+	std::uint64_t start;
+
+public: // -- ctor / dtor / asgn -- //
+
+	// starts a zone with the given name and category (if recording is on)
+	explicit trace_zone(const char *zone_name, const char *category = "zone") noexcept
+		: name(fate_trace::enabled() ? zone_name : nullptr), cat(category), start(name ? fate_trace::now() : 0)
+	{}
+
+	~trace_zone()
+	{
+		if (name) fate_trace::record(name, cat, start, fate_trace::now());
+	}
+
+	trace_zone(const trace_zone&) = delete;
+	trace_zone &operator=(const trace_zone&) = delete;
+};
+
+// traced_fate is a fate that shows up on the trace timeline: it records a "scope" event from construction until it is invoked or released,
+// and a "cleanup" event covering the execution of its function. it otherwise behaves exactly like fate.
+template<typename T>
+class traced_fate
+{
+private: // -- data -- //
+
+	fate<T> inner;
+	const char *name; // null if not recording (or empty)
+	std::uint64_t start;
+
+public: // -- ctor / dtor / asgn -- //
+
+	// creates a traced fate with the given name for the given function-like object - the argument will be forwarded to the fate<T> constructor.
+	// on failure, an exception is thrown.
+	template<typename J, std::enable_if_t<!std::is_same_v<std::decay_t<J>, traced_fate>, int> = 0>
+	traced_fate(const char *zone_name, J &&arg) : inner(std::forward<J>(arg)), name(inner && fate_trace::enabled() ? zone_name : nullptr), start(name ? fate_trace::now() : 0) {}
+
+	~traced_fate() { (*this)(); }
+
+	traced_fate(const traced_fate&) = delete;
+	traced_fate &operator=(const traced_fate&) = delete;
+
+	// constructs a new traced fate by transfering other's contract (and its open scope event) to the new instance
+	traced_fate(traced_fate &&other) noexcept : inner(std::move(other.inner)), name(other.name), start(other.start)
+	{
+		other.name = nullptr;
+	}
+	// if this instance currently has a function, it is invoked. after this, other's contract is transfered to this instance.
+	// in the special case of self-assignment, does nothing.
+	traced_fate &operator=(traced_fate &&other) noexcept
+	{
+		if (this != &other)
+		{
+			(*this)();
+			inner = std::move(other.inner);
+			name = other.name;
+			start = other.start;
+			other.name = nullptr;
+		}
+		return *this;
+	}
+
+public: // -- utilities -- //
+
+	// triggers the fate to call its stored function (if any), recording the cleanup and the end of the scope.
+	// if the function-like object throws an exception, it is caught and ignored.
+	void operator()() noexcept
+	{
+		// take the name first (so that if the function calls this function we don't record anything twice)
+		const char *const n = name;
+		name = nullptr;
+
+		if (!n) { inner(); return; }
+
+		const std::uint64_t t = fate_trace::now();
+		inner();
+		const std::uint64_t end = fate_trace::now();
+		fate_trace::record(n, "cleanup", t, end);
+		fate_trace::record(n, "scope", start, end);
+	}
+
+	// abandons the stored function (if any), recording the end of the scope
+	void release() noexcept
+	{
+		inner.release();
+		if (name) fate_trace::record(name, "scope", start, fate_trace::now());
+		name = nullptr;
+	}
+
+	// returns true iff this traced fate is still associated with a function object
+	explicit operator bool() const noexcept { return (bool)inner; }
+	// returns true iff this traced fate is not associated with a function object
+	bool operator!() const noexcept { return !inner; }
+
+	// returns true iff this traced fate is not associated with a function object
+	bool empty() const noexcept { return !inner; }
+};
+
+// creates a traced_fate object with the given name from the given function-like object
+template<typename T>
+traced_fate<std::decay_t<T>> make_traced_fate(const char *zone_name, T &&arg) { return traced_fate<std::decay_t<T>>(zone_name, std::forward<T>(arg)); }
+
+// a chrome trace json file that fate_trace events are flushed into (on demand, or periodically with a fate_trace_flusher).
+// the file is a json array that is left open while it is being written to (which the trace viewers accept), and it is closed off on destruction.
+class fate_trace_file
+{
+private: // -- data -- //
+
+	std::mutex mutex;
+	std::ofstream file;
+
+public: // -- ctor / dtor / asgn -- //
+
+	// creates (or truncates) the file at path. throws on failure.
+	explicit fate_trace_file(const std::string &path) : file(path, std::ios::out | std::ios::trunc | std::ios::binary)
+	{
+		if (!file) throw std::runtime_error("failed to open trace file " + path);
+		file << "[\n";
+	}
+
+	// flushes any remaining events and closes off the json array (with a process name record, since every event is followed by a comma)
+	~fate_trace_file()
+	{
+		try
+		{
+			flush();
+			file << "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"args\":{\"name\":\"fate_trace\"}}]\n";
+		}
+		catch (...) {}
+	}
+
+	fate_trace_file(const fate_trace_file&) = delete;
+	fate_trace_file &operator=(const fate_trace_file&) = delete;
+
+public: // -- interface -- //
+
+	// moves all buffered events into the file (see fate_trace::flush). threadsafe. returns the number of events written.
+	std::size_t flush()
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		const std::size_t count = fate_trace::flush(file);
+		file.flush();
+		return count;
+	}
+};
+
+// flushes a fate_trace_file from a background thread every interval, so per-thread buffers don't fill up
+class fate_trace_flusher
+{
+private: // -- data -- //
+
+	fate_trace_file &target;
+	std::chrono::steady_clock::duration interval;
+
+	std::mutex mutex;
+	std::condition_variable wake;
+	bool stopping = false;
+
+	std::thread worker;
+
+	void loop() noexcept
+	{
+		std::unique_lock<std::mutex> lock(mutex);
+		while (!wake.wait_for(lock, interval, [this] { return stopping; }))
+		{
+			lock.unlock();
+			try { target.flush(); }
+			catch (...) {}
+			lock.lock();
+		}
+	}
+
+public: // -- ctor / dtor / asgn -- //
+
+	// starts flushing. throws on failure (e.g. if the thread can't be started).
+	explicit fate_trace_flusher(fate_trace_file &file, std::chrono::steady_clock::duration flush_interval = std::chrono::milliseconds(100))
+		: target(file), interval(flush_interval), worker([this] { loop(); })
+	{}
+
+	// stops flushing (waits for an in-progress flush to finish)
+	~fate_trace_flusher()
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			stopping = true;
+		}
+		wake.notify_all();
+		worker.join();
+	}
+
+	fate_trace_flusher(const fate_trace_flusher&) = delete;
+	fate_trace_flusher &operator=(const fate_trace_flusher&) = delete;
+};
+
+#endif
@@ -0,0 +1,196 @@
+#ifndef DRAGAZO_INCREMENTAL_CLEANUP_H
+#define DRAGAZO_INCREMENTAL_CLEANUP_H
+
+#include <chrono>
+#include <cstddef>
+#include <deque>
+#include <limits>
+#include <memory>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "fate.h"
+
+// incremental_cleanup is a queue of cleanup work that is run a little at a time on the calling thread, under a time and/or work budget.
+// it holds two kinds of work:
+//     one-shot cleanups (any function-like object or fate) - each counts as a single step.
+//     resumable jobs - function-like objects returning bool that do a slice of work per call and return true once they're finished.
+// run_for() steps through the queue in order until it's empty or the budget runs out, and picks up where it left off next time.
+// there is also a frame-deferred list: cleanups added with defer() are held until end_frame(), which runs them all.
+// as with fate, exceptions thrown by cleanups are caught and ignored (a job that throws counts as finished).
+// anything still queued when the incremental_cleanup is destroyed is run to completion at that point (nothing is silently dropped).
+// this is not designed to be threadsafe - it is meant to be owned and driven by a single (e.g. simulation tick) thread.
+class incremental_cleanup
+{
+public: // -- types -- //
+
+	typedef std::chrono::steady_clock clock;
+
+private: // -- data -- //
+
+	// type-erased resumable job (std::function won't do since jobs are often move-only, e.g. anything holding a fate)
+	struct job_base
+	{
+		virtual ~job_base() = default;
+		// runs one slice of work and returns true once the job is finished
+		virtual bool step() = 0;
+		// makes sure destroying the job won't run anything (resumable jobs are just destroyed in whatever state they're in)
+		virtual void abandon() noexcept {}
+	};
+	template<typename F>
+	struct job_impl final : job_base
+	{
+		F func;
+
+		template<typename J>
+		explicit job_impl(J &&f) : func(std::forward<J>(f)) {}
+
+		bool step() override { return func(); }
+	};
+	// a one-shot cleanup is just a fate that finishes in a single step
+	template<typename T>
+	struct one_shot_impl final : job_base
+	{
+		fate<T> func;
+
+		template<typename J>
+		explicit one_shot_impl(J &&f) : func(std::forward<J>(f)) {}
+
+		bool step() override { func(); return true; }
+		void abandon() noexcept override { func.release(); }
+	};
+
+	typedef std::unique_ptr<job_base> job;
+
+	std::deque<job> jobs;
+
+	// cleanups waiting for end_frame()
+	std::vector<job> deferred;
+
+	template<typename F>
+	static job one_shot(F &&f) { return job(new one_shot_impl<std::decay_t<F>>(std::forward<F>(f))); }
+	// a fate is moved into the job's own fate (rather than wrapped in another one), so that abandon() releases the original function
+	template<typename T>
+	static job one_shot(fate<T> &&f) { return job(new one_shot_impl<T>(std::move(f))); }
+
+	// runs a single step of a job. returns true if the job is finished.
+	static bool step(job &j) noexcept
+	{
+		try { return j->step(); }
+		catch (...) { return true; }
+	}
+
+public: // -- ctor / dtor / asgn -- //
+
+	incremental_cleanup() = default;
+
+	// runs everything that's left (deferred cleanups first, since they belong to the current frame)
+	~incremental_cleanup()
+	{
+		end_frame();
+		run_all();
+	}
+
+	incremental_cleanup(const incremental_cleanup&) = delete;
+	incremental_cleanup &operator=(const incremental_cleanup&) = delete;
+
+public: // -- queueing -- //
+
+	// queues a one-shot cleanup (a function-like object taking no args, or a fate object, which is moved from).
+	template<typename F>
+	void push(F &&f) { jobs.emplace_back(one_shot(std::forward<F>(f))); }
+
+	// queues a resumable job. each call to f() should do a bounded slice of work and return true once there's nothing left to do.
+	template<typename F>
+	void push_job(F &&f) { jobs.emplace_back(job(new job_impl<std::decay_t<F>>(std::forward<F>(f)))); }
+
+	// holds a one-shot cleanup until the next end_frame()
+	template<typename F>
+	void defer(F &&f) { deferred.emplace_back(one_shot(std::forward<F>(f))); }
+
+public: // -- running -- //
+
+	// runs queued work (in order) until the queue is empty, budget time has elapsed, or max_steps steps have been run.
+	// the clock is checked after every step, so a single step can overrun the budget - keep job slices small.
+	// returns true iff the queue is empty afterwards.
+	bool run_for(clock::duration budget, std::size_t max_steps = std::numeric_limits<std::size_t>::max()) noexcept
+	{
+		const clock::time_point deadline = clock::now() + budget;
+		for (std::size_t steps = 0; !jobs.empty() && steps < max_steps; ++steps)
+		{
+			if (step(jobs.front())) jobs.pop_front();
+			if (clock::now() >= deadline) break;
+		}
+		return jobs.empty();
+	}
+
+	// runs up to max_steps steps of queued work regardless of time. returns true iff the queue is empty afterwards.
+	bool run_steps(std::size_t max_steps) noexcept
+	{
+		for (std::size_t steps = 0; !jobs.empty() && steps < max_steps; ++steps)
+		{
+			if (step(jobs.front())) jobs.pop_front();
+		}
+		return jobs.empty();
+	}
+
+	// runs every queued job to completion
+	void run_all() noexcept
+	{
+		while (!jobs.empty())
+		{
+			if (step(jobs.front())) jobs.pop_front();
+		}
+	}
+
+	// runs every cleanup that was deferred during the current frame (in the order they were deferred)
+	void end_frame() noexcept
+	{
+		// swap out first so that cleanups deferring more cleanups go to the next frame
+		std::vector<job> frame;
+		frame.swap(deferred);
+		for (auto &f : frame) step(f);
+
+		// keep the capacity around for next frame if nothing else grabbed it
+		frame.clear();
+		if (deferred.empty()) deferred.swap(frame);
+	}
+
+	// abandons all queued and deferred work. like fate::release(), one-shot cleanups are destroyed without being invoked.
+	// resumable jobs are destroyed in whatever state they were left in.
+	void release() noexcept
+	{
+		for (auto &j : jobs) j->abandon();
+		for (auto &j : deferred) j->abandon();
+		jobs.clear();
+		deferred.clear();
+	}
+
+public: // -- utilities -- //
+
+	// returns true iff there is no queued (non-deferred) work
+	bool empty() const noexcept { return jobs.empty(); }
+	// returns the number of queued (non-deferred) jobs
+	std::size_t size() const noexcept { return jobs.size(); }
+	// returns the number of cleanups waiting for end_frame()
+	std::size_t deferred_size() const noexcept { return deferred.size(); }
+};
+
+// creates a resumable job that takes ownership of c and destroys up to batch elements (from the back) per step.
+// the container's own storage is released in the final step.
+// works with any container that has back(), pop_back() and empty() (e.g. std::vector, std::deque, std::string).
+template<typename Container>
+auto incremental_destroy(Container &&c, std::size_t batch = 1024)
+{
+	return [c = std::decay_t<Container>(std::forward<Container>(c)), batch]() mutable
+	{
+		for (std::size_t i = 0; i < batch && !c.empty(); ++i) c.pop_back();
+		if (!c.empty()) return false;
+
+		std::decay_t<Container>().swap(c);
+		return true;
+	};
+}
+
+#endif
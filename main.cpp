@@ -1,8 +1,61 @@
 #include <iostream>
 #include <string>
 #include <exception>
+#include <stdexcept>
+#include <cmath>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <filesystem>
+#include <iterator>
+#include <csignal>
+#include <cstdint>
+#include <cstdlib>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <sstream>
 
+// the C++20 build also turns on the opt-in instrumentation (per-site counters and timing, and usdt probes), so that it gets exercised too
+#if __cplusplus >= 202002L
+#define DRAGAZO_FATE_STATS
+#define DRAGAZO_FATE_TIMING
+#define DRAGAZO_FATE_SDT
+#endif
 #include "fate.h"
+#include "owner_fate.h"
+#include "deadline_fate.h"
+#include "incremental_cleanup.h"
+#include "shutdown_graph.h"
+#include "exit_registry.h"
+#include "parallel_destroy.h"
+#include "fate_trace.h"
+#include "countdown_fate.h"
+#include "thread_exit.h"
+#include "concurrent_fate_collector.h"
+#include "signal_cleanup.h"
+#include "robust_fate_table.h"
+#include "reclaim_registry.h"
+#include "scope_guards.h"
+#include "rollback_guard.h"
+#include "unique_resource.h"
+#if __cplusplus >= 202002L
+#include "async_fate.h"
+#include "completion_fate.h"
+#endif
+#if defined(__unix__) || defined(__APPLE__)
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/wait.h>
+#include <sys/mman.h>
+#include "durable_fate_journal.h"
+#include "atomic_file_batch.h"
+#include "teardown_batch.h"
+#endif
 
 // pretend synchronized resource for an example of usage
 struct resource
@@ -19,6 +72,74 @@ resource &get_external_resource() { return some_external_resource; }
 
 // -----------------------------
 
+// number of failed smoke checks (reported at the end)
+int smoke_failures = 0;
+
+void smoke_check(bool ok, const char *what)
+{
+	std::cerr << (ok ? "ok: " : "FAILED: ") << what << '\n';
+	if (!ok) ++smoke_failures;
+}
+
+// deleters for the unique_resource checks (they have to be usable as template arguments)
+std::vector<int> smoke_deleted_handles;
+void smoke_delete_handle(int h) { smoke_deleted_handles.push_back(h); }
+int smoke_deleted_pointers = 0;
+void smoke_delete_pointer(int *p) { delete p; ++smoke_deleted_pointers; }
+
+#if __cplusplus >= 202002L
+// minimal eager, fire-and-forget coroutine type for the async_fate smoke checks
+struct smoke_task
+{
+	struct promise_type
+	{
+		smoke_task get_return_object() noexcept { return {}; }
+		std::suspend_never initial_suspend() noexcept { return {}; }
+		std::suspend_never final_suspend() noexcept { return {}; }
+		void return_void() noexcept {}
+		void unhandled_exception() noexcept { std::terminate(); }
+	};
+};
+
+// coroutines suspended on a smoke_wait (resumed by hand, oldest first)
+std::vector<std::coroutine_handle<>> smoke_waiting;
+
+struct smoke_wait
+{
+	bool await_ready() const noexcept { return false; }
+	void await_suspend(std::coroutine_handle<> h) { smoke_waiting.push_back(h); }
+	void await_resume() const noexcept {}
+};
+
+// resumes one waiting coroutine. returns false if there weren't any.
+bool smoke_resume_one()
+{
+	if (smoke_waiting.empty()) return false;
+	std::coroutine_handle<> h = smoke_waiting.front();
+	smoke_waiting.erase(smoke_waiting.begin());
+	h.resume();
+	return true;
+}
+
+// registers three async cleanups (each logs when it starts, then suspends once) and a released one, then closes the scope
+smoke_task async_scope_smoke(std::vector<int> &log, bool concurrent, bool &done)
+{
+	async_scope scope;
+	auto step = [&log](int id) { return [&log, id] { log.push_back(id); return smoke_wait{}; }; };
+
+	auto a = make_async_fate(scope, step(1));
+	auto b = make_async_fate(scope, step(2));
+	auto r = make_async_fate(scope, step(9));
+	auto c = make_async_fate(scope, step(3));
+	r.release();
+
+	co_await scope.close(concurrent);
+	done = scope.empty() && !a && !b && !c;
+}
+#endif
+
+// -----------------------------
+
 void foo()
 {
 	std::cerr << "foo\n";
@@ -140,7 +261,941 @@ int main()
 	{
 		std::cerr << "ERROR: " << ex.what() << '\n';
 	}
-	
+
+	std::cerr << '\n';
+
+	// owner_fate - fates dropped on other threads are handed back to the owner, which runs them at drain_remote_fates()
+	{
+		std::cerr << "owner_fate\n";
+		const std::thread::id owner = std::this_thread::get_id();
+		std::atomic<int> ran{0};
+		std::atomic<int> foreign{0};
+		auto count = [&] { ++ran; if (std::this_thread::get_id() != owner) ++foreign; };
+
+		std::vector<std::vector<owner_fate<decltype(count)>>> batches(4);
+		for (auto &batch : batches) for (int i = 0; i < 250; ++i) batch.push_back(make_owner_fate(count));
+
+		// drop them all from other threads while we keep draining
+		std::atomic<bool> go{false};
+		std::vector<std::thread> droppers;
+		for (auto &batch : batches) droppers.emplace_back([&] { while (!go) {} batch.clear(); });
+		go = true;
+		std::size_t drained = 0;
+		while (drained < 1000) drained += drain_remote_fates();
+		for (auto &t : droppers) t.join();
+
+		smoke_check(drained == 1000 && ran == 1000, "every remotely dropped owner_fate is drained exactly once");
+		smoke_check(foreign == 0, "owner_fate functions only run on the owner thread");
+		smoke_check(drain_remote_fates() == 0, "the queue is empty after draining");
+	}
+	{
+		std::cerr << "owner_fate (orphaned)\n";
+		std::atomic<int> ran{0};
+		auto count = [&] { ++ran; };
+		std::vector<owner_fate<decltype(count)>> early, late;
+
+		// the owner hands its fates over, waits while some are dropped (queued, since it is still alive), then exits without draining
+		std::atomic<int> stage{0};
+		std::thread owner([&]
+		{
+			for (int i = 0; i < 10; ++i) early.push_back(make_owner_fate(count));
+			for (int i = 0; i < 10; ++i) late.push_back(make_owner_fate(count));
+			stage = 1;
+			while (stage != 2) {}
+		});
+		while (stage != 1) {}
+		early.clear();
+		smoke_check(ran == 0, "fates dropped while the owner is alive are queued, not run");
+		stage = 2;
+		owner.join();
+		smoke_check(ran == 10, "an exiting owner runs what was queued for it");
+
+		// the owner is gone, so these run right here
+		late.clear();
+		smoke_check(ran == 20, "fates of an exited owner run on the dropping thread");
+	}
+
+	// deadline_fate - expiry on every level of the timer wheel (driven with explicit time points, so nothing actually waits), plus early invoke and release
+	{
+		std::cerr << "deadline_fate\n";
+		using namespace std::chrono_literals;
+		timer_wheel wheel; // 1ms ticks: level 0 covers 64ms, level 1 ~4s, level 2 ~4min, level 3 ~4.6h
+		const auto t0 = timer_wheel::clock::now();
+
+		std::vector<int> fired;
+		auto mark = [&](int id) { return [&fired, id] { fired.push_back(id); }; };
+
+		auto a = make_deadline_fate(wheel, t0 + 5ms, mark(1));    // level 0
+		auto b = make_deadline_fate(wheel, t0 + 1s, mark(2));     // level 1
+		auto c = make_deadline_fate(wheel, t0 + 100s, mark(3));   // level 2
+		auto d = make_deadline_fate(wheel, t0 + 3600s, mark(4));  // level 3
+		auto e = make_deadline_fate(wheel, t0 + 150s, mark(5));   // released before it's due
+		auto f = make_deadline_fate(wheel, t0 + 30s, mark(6));    // invoked before it's due
+		smoke_check(wheel.size() == 6, "deadline_fates are armed on construction");
+
+		e.release();
+		f();
+		smoke_check(wheel.size() == 4 && !e.pending() && !f.pending(), "release and early invoke disarm the deadline");
+		smoke_check(fired == std::vector<int>{ 6 }, "early invoke runs the function immediately");
+
+		smoke_check(wheel.advance(t0 + 2ms) == 0, "nothing fires before its deadline");
+		smoke_check(wheel.advance(t0 + 10ms) == 1, "level 0 deadline fires");
+		smoke_check(wheel.advance(t0 + 500ms) == 0 && wheel.advance(t0 + 2s) == 1, "level 1 deadline fires on time");
+		smoke_check(wheel.advance(t0 + 50s) == 0 && wheel.advance(t0 + 200s) == 1, "level 2 deadline fires on time (and the released one doesn't)");
+		smoke_check(wheel.advance(t0 + 3500s) == 0 && wheel.advance(t0 + 3700s) == 1, "level 3 deadline fires on time");
+		smoke_check(fired == std::vector<int>({ 6, 1, 2, 3, 4 }), "deadlines fire in order, exactly once");
+		smoke_check(wheel.size() == 0 && !a && !b && !c && !d, "fired deadline_fates are empty");
+	}
+
+#if __cplusplus >= 202002L
+	// async_scope - a serial close() awaits one cleanup at a time (newest first), a concurrent one starts them all and resumes once they're all done
+	{
+		std::cerr << "async_scope (serial)\n";
+		smoke_waiting.reserve(16);
+		std::vector<int> log;
+		bool done = false;
+		async_scope_smoke(log, false, done);
+
+		// while anything is still waiting, exactly one cleanup is in flight and the coroutine hasn't resumed
+		bool one_at_a_time = true;
+		while (!smoke_waiting.empty())
+		{
+			one_at_a_time = one_at_a_time && smoke_waiting.size() == 1 && !done;
+			smoke_resume_one();
+		}
+
+		smoke_check(one_at_a_time, "serial close runs one cleanup at a time");
+		smoke_check(log == std::vector<int>({ 3, 2, 1 }), "serial close runs cleanups newest first (skipping released ones)");
+		smoke_check(done, "the coroutine resumes after serial close, with its scope empty");
+	}
+	{
+		std::cerr << "async_scope (concurrent)\n";
+		std::vector<int> log;
+		bool done = false;
+		async_scope_smoke(log, true, done);
+
+		smoke_check(smoke_waiting.size() == 3 && log.size() == 3, "concurrent close starts every cleanup at once");
+		smoke_resume_one();
+		smoke_resume_one();
+		smoke_check(!done, "the coroutine waits for the last cleanup");
+		smoke_resume_one();
+		std::sort(log.begin(), log.end());
+		smoke_check(done && log == std::vector<int>({ 1, 2, 3 }), "the coroutine resumes once every cleanup is done (skipping released ones)");
+		smoke_check(smoke_waiting.empty(), "nothing is left waiting");
+	}
+#endif
+
+#if defined(__unix__) || defined(__APPLE__)
+	// durable_fate_journal - obligations left armed at a "crash" are recovered on the next start, up to the first corrupt record
+	{
+		std::cerr << "durable_fate_journal\n";
+		const char *const path = "fate_smoke.journal";
+		std::remove(path);
+		int local_runs = 0;
+
+		{
+			durable_fate_journal journal(path, 64 << 10);
+
+			// a durable_fate that runs normally leaves nothing behind
+			{
+				auto done = make_durable_fate(journal, "obligation-done", [&] { ++local_runs; });
+			}
+
+			// obligations we never complete (as if the process died), one that is completed, and a last one whose record gets corrupted below
+			journal.arm("obligation-a");
+			const std::uint64_t b = journal.arm("obligation-b");
+			journal.arm("obligation-c");
+			journal.complete(b);
+			journal.arm("obligation-last");
+			journal.sync();
+			smoke_check(local_runs == 1 && journal.pending() == 3, "completed obligations are no longer pending");
+		}
+
+		// flip a byte in the last record's payload (its checksum no longer matches)
+		{
+			std::fstream file(path, std::ios::in | std::ios::out | std::ios::binary);
+			const std::string bytes((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+			const std::size_t at = bytes.find("obligation-last");
+			smoke_check(at != std::string::npos, "the last record is in the journal file");
+			file.clear();
+			file.seekp((std::streamoff)at);
+			file.put('O');
+		}
+
+		{
+			durable_fate_journal journal(path, 64 << 10);
+			smoke_check(journal.pending() == 2, "replay stops at the corrupt record");
+
+			std::vector<std::string> recovered;
+			const std::size_t count = journal.recover([&](std::uint64_t, std::string_view payload) { recovered.emplace_back(payload); });
+			smoke_check(count == 2 && recovered == std::vector<std::string>({ "obligation-a", "obligation-c" }), "recover() hands back the armed obligations in order");
+			smoke_check(journal.pending() == 0, "recovered obligations are completed");
+		}
+
+		{
+			durable_fate_journal journal(path);
+			smoke_check(journal.pending() == 0, "recovered obligations stay completed after reopening");
+			journal.arm("obligation-e");
+			smoke_check(journal.pending() == 1, "the journal is still usable after recovering from a corrupt tail");
+		}
+
+		std::remove(path);
+	}
+#endif
+
+	// incremental_cleanup - release abandons queued and deferred work, running the queue (or ending the frame) invokes it
+	{
+		std::cerr << "incremental_cleanup\n";
+		int ran = 0;
+		{
+			incremental_cleanup queue;
+			queue.push([&] { ++ran; });
+			queue.push(make_fate([&] { ++ran; }));
+			queue.push_job([&] { ++ran; return true; });
+			queue.defer(make_fate([&] { ++ran; }));
+			queue.release();
+			smoke_check(queue.empty() && queue.deferred_size() == 0, "release empties the queue and the frame list");
+		}
+		smoke_check(ran == 0, "released cleanups (and fates pushed as cleanups) are never run");
+
+		std::vector<int> order;
+		{
+			incremental_cleanup queue;
+			queue.push([&] { order.push_back(1); });
+			queue.push(make_fate([&] { order.push_back(2); }));
+			int slices = 0;
+			queue.push_job([&] { order.push_back(3); return ++slices == 3; });
+			queue.defer([&] { order.push_back(4); });
+
+			smoke_check(!queue.run_steps(3) && order == std::vector<int>({ 1, 2, 3 }), "run_steps runs the queue in order, a step at a time");
+			queue.end_frame();
+			smoke_check(order.back() == 4 && queue.deferred_size() == 0, "end_frame runs deferred cleanups");
+			queue.push([&] { order.push_back(5); });
+		}
+		smoke_check(order == std::vector<int>({ 1, 2, 3, 4, 3, 3, 5 }), "leftover work is run to completion on destruction, exactly once");
+	}
+
+
+	// shutdown_graph - nodes run after everything that depends on them (on several threads), move-only cleanups and fates are accepted as nodes
+	{
+		std::cerr << "shutdown_graph\n";
+		std::mutex mutex;
+		std::vector<int> order;
+		auto mark = [&](int id) { return [&, id] { std::lock_guard<std::mutex> lock(mutex); order.push_back(id); }; };
+		auto position = [&](int id) { return std::find(order.begin(), order.end(), id) - order.begin(); };
+
+		{
+			shutdown_graph graph;
+			auto owned = std::make_unique<int>(1);
+			const auto db = graph.add([&, owned = std::move(owned)] { mark(*owned)(); }, {}, "db");   // move-only
+			const auto cache = graph.add(make_fate(mark(2)), { db }, "cache");
+			const auto log = graph.add(mark(3), {}, "log");
+			graph.add(mark(4), { cache, log }, "server");
+			graph.add(mark(5), { db }, "metrics");
+			graph.run(4);
+
+			smoke_check(order.size() == 5, "every node runs exactly once");
+			smoke_check(position(4) < position(2) && position(2) < position(1) && position(5) < position(1) && position(4) < position(3), "nodes run after all of their dependents");
+			smoke_check(graph.critical_path().size() >= 2, "the critical path follows a dependency chain");
+		}
+		smoke_check(order.size() == 5, "a graph that has been run doesn't run again on destruction");
+
+		order.clear();
+		{
+			shutdown_graph graph;
+			const auto a = graph.add(make_fate(mark(1)));
+			graph.add(mark(2), { a });
+			graph.release();
+		}
+		smoke_check(order.empty(), "released nodes (including fates) are never run");
+	}
+
+
+	// exit_registry - LIFO within a class, exactly once, and what fast_exit() runs from each class (checked in a forked child, since it ends the process)
+	{
+		std::cerr << "exit_registry\n";
+		std::vector<int> order;
+		for (int i = 1; i <= 3; ++i) at_process_exit([&order, i] { order.push_back(i); }, exit_priority::best_effort);
+		at_process_exit([&order] { order.push_back(4); }, exit_priority::skip_on_fast_exit);
+		exit_registry::instance().run(exit_priority::best_effort);
+		smoke_check(order == std::vector<int>({ 3, 2, 1 }), "a class runs newest first");
+		exit_registry::instance().release(exit_priority::skip_on_fast_exit);
+		exit_registry::instance().run_all();
+		smoke_check(order.size() == 3, "fates run (or are released) exactly once");
+
+#if defined(__unix__) || defined(__APPLE__)
+		// the child reports which fates ran down a pipe: must_run always, best_effort only with a budget, skip_on_fast_exit never
+		auto fast_exit_runs = [](std::chrono::steady_clock::duration budget)
+		{
+			int fds[2];
+			if (pipe(fds) != 0) return std::string("pipe failed");
+			const pid_t pid = fork();
+			if (pid == 0)
+			{
+				close(fds[0]);
+				const int out = fds[1];
+				at_process_exit([out] { (void)!write(out, "s", 1); }, exit_priority::skip_on_fast_exit);
+				at_process_exit([out] { (void)!write(out, "b", 1); }, exit_priority::best_effort);
+				at_process_exit([out] { (void)!write(out, "m", 1); }, exit_priority::must_run);
+				fast_exit(0, budget);
+			}
+			close(fds[1]);
+			std::string ran;
+			char c;
+			while (read(fds[0], &c, 1) == 1) ran += c;
+			close(fds[0]);
+			waitpid(pid, nullptr, 0);
+			return ran;
+		};
+		smoke_check(fast_exit_runs({}) == "m", "fast_exit with no budget runs only must_run");
+		smoke_check(fast_exit_runs(std::chrono::seconds(10)) == "mb", "fast_exit runs best_effort within its budget, but never skip_on_fast_exit");
+#endif
+	}
+
+
+	// parallel_destroy - every element is destroyed exactly once (across the workers), release destroys the container without invoking the fate
+	{
+		std::cerr << "parallel_destroy\n";
+		struct counted
+		{
+			std::atomic<int> *count;
+			explicit counted(std::atomic<int> &c) noexcept : count(&c) {}
+			counted(counted &&other) noexcept : count(other.count) { other.count = nullptr; }
+			~counted() { if (count) ++*count; }
+		};
+		std::atomic<int> destroyed{0};
+
+		std::vector<counted> items;
+		for (int i = 0; i < 10000; ++i) items.emplace_back(destroyed);
+		parallel_destroy(items, { 4, 100 });
+		smoke_check(destroyed == 10000 && items.empty(), "parallel_destroy destroys every element exactly once and empties the container");
+
+		destroyed = 0;
+		for (int i = 0; i < 1000; ++i) items.emplace_back(destroyed);
+		{
+			auto teardown = make_parallel_destroy_fate(std::move(items), { 2, 64 });
+			smoke_check(destroyed == 0, "make_parallel_destroy_fate defers destruction");
+			teardown();
+			smoke_check(destroyed == 1000 && !teardown, "invoking the fate destroys the container");
+		}
+		smoke_check(destroyed == 1000, "an invoked parallel_destroy fate doesn't run again");
+
+		destroyed = 0;
+		std::vector<counted> kept;
+		for (int i = 0; i < 100; ++i) kept.emplace_back(destroyed);
+		{
+			auto teardown = make_parallel_destroy_fate(std::move(kept));
+			teardown.release();
+		}
+		smoke_check(destroyed == 100, "a released parallel_destroy fate still destroys the container (serially)");
+	}
+
+
+	// traced_fate / trace_zone - invoke records a cleanup and a scope event, release only the scope, and nothing is recorded twice
+	{
+		std::cerr << "traced_fate\n";
+		std::ostringstream trace;
+		fate_trace::flush(trace);
+		trace.str("");
+
+		int ran = 0;
+		{
+			trace_zone zone("smoke zone");
+			auto invoked = make_traced_fate("smoke invoked", [&] { ++ran; });
+			auto released = make_traced_fate("smoke released", [&] { ++ran; });
+			invoked();
+			released.release();
+			smoke_check(ran == 1 && !invoked && !released, "traced_fate invokes and releases like fate");
+		}
+		smoke_check(ran == 1, "an invoked or released traced_fate doesn't run again");
+
+		smoke_check(fate_trace::flush(trace) == 4, "invoke records two events, release and trace_zone one each");
+		const std::string json = trace.str();
+		auto events = [&](const char *name, const char *cat)
+		{
+			const std::string key = std::string("{\"name\":\"") + name + "\",\"cat\":\"" + cat + "\"";
+			std::size_t n = 0;
+			for (std::size_t at = json.find(key); at != std::string::npos; at = json.find(key, at + 1)) ++n;
+			return n;
+		};
+		smoke_check(events("smoke invoked", "cleanup") == 1 && events("smoke invoked", "scope") == 1, "an invoked traced_fate records its cleanup and its scope");
+		smoke_check(events("smoke released", "cleanup") == 0 && events("smoke released", "scope") == 1, "a released traced_fate records only its scope");
+		smoke_check(events("smoke zone", "zone") == 1, "trace_zone records its lifetime");
+	}
+
+
+	// countdown_fate - fires exactly once, on the last arrival (from whichever thread that is), unless a participant cancels
+	{
+		std::cerr << "countdown_fate\n";
+		std::atomic<int> ran{0};
+		std::atomic<int> last{0};
+		{
+			auto done = make_countdown_fate(8000, [&] { ++ran; });
+			std::vector<std::thread> participants;
+			for (int t = 0; t < 8; ++t) participants.emplace_back([&] { for (int i = 0; i < 1000; ++i) if (done.arrive()) ++last; });
+			for (auto &t : participants) t.join();
+			smoke_check(ran == 1 && last == 1 && done.remaining() == 0 && !done, "the last of many concurrent arrivals invokes the function exactly once");
+		}
+		smoke_check(ran == 1, "a fired countdown_fate doesn't run again on destruction");
+
+		{
+			auto done = make_countdown_fate(3, [&] { ++ran; });
+			done.arrive();
+			done.arrive_and_release();
+			smoke_check(ran == 1 && done, "a cancelled countdown_fate waits for the remaining arrivals");
+			smoke_check(done.arrive() && ran == 1 && !done, "the last arrival abandons a cancelled countdown_fate");
+		}
+		{
+			auto done = make_countdown_fate(2, [&] { ++ran; });
+			done.release();
+			done.arrive(2);
+			smoke_check(ran == 1 && !done, "a released countdown_fate is never invoked");
+		}
+		{
+			auto done = make_countdown_fate(2, [&] { ++ran; });
+			done.arrive();
+		}
+		smoke_check(ran == 2, "a countdown_fate destroyed early invokes its function, like fate");
+	}
+
+
+#if __cplusplus >= 202002L
+	// completion_fate - waiters on other threads see everything the function did, release counts as completion
+	{
+		std::cerr << "completion_fate\n";
+		int value = 0;
+		std::atomic<int> seen{0};
+		{
+			auto published = make_completion_fate([&] { value = 42; });
+			std::vector<std::thread> waiters;
+			for (int t = 0; t < 4; ++t) waiters.emplace_back([&] { published.wait(); if (value == 42) ++seen; });
+			smoke_check(!published.try_wait() && value == 0, "a completion_fate isn't complete before it's invoked");
+			published();
+			for (auto &t : waiters) t.join();
+			smoke_check(seen == 4 && published.try_wait() && !published, "every waiter wakes after the function has run");
+		}
+
+		int ran = 0;
+		{
+			auto abandoned = make_completion_fate([&] { ++ran; });
+			std::thread waiter([&] { abandoned.wait(); });
+			abandoned.release();
+			waiter.join();
+			smoke_check(abandoned.try_wait() && !abandoned, "releasing a completion_fate completes it for waiters");
+		}
+		smoke_check(ran == 0, "a released completion_fate is never invoked");
+		{
+			auto dropped = make_completion_fate([&] { ++ran; });
+		}
+		smoke_check(ran == 1, "a completion_fate invokes its function on destruction, like fate");
+	}
+#endif
+
+
+	// at_thread_exit - runs on the registering thread when it exits, LIFO and exactly once (including fates registered while running)
+	{
+		std::cerr << "at_thread_exit\n";
+		std::vector<int> order;
+		std::thread::id ran_on;
+		std::thread::id worker_id;
+		std::thread worker([&]
+		{
+			worker_id = std::this_thread::get_id();
+			for (int i = 1; i <= 40; ++i) at_thread_exit([&order, i] { order.push_back(i); }); // more than fit in the first chunk
+			at_thread_exit(make_fate([&] { ran_on = std::this_thread::get_id(); at_thread_exit([&order] { order.push_back(0); }); }));
+		});
+		worker.join();
+
+		std::vector<int> expected{ 0 };
+		for (int i = 40; i >= 1; --i) expected.push_back(i);
+		smoke_check(order == expected, "thread exit fates run newest first, and fates registered while running run next");
+		smoke_check(ran_on == worker_id, "thread exit fates run on the exiting thread");
+
+		order.clear();
+		std::thread([&]
+		{
+			at_thread_exit([&order] { order.push_back(1); });
+			at_thread_exit([&order] { order.push_back(2); });
+			thread_exit_registry::local()->run();
+			order.push_back(3);
+			at_thread_exit([&order] { order.push_back(4); });
+			thread_exit_registry::local()->release();
+		}).join();
+		smoke_check(order == std::vector<int>({ 2, 1, 3 }), "run() invokes early and release() abandons, each exactly once");
+	}
+
+
+	// concurrent_fate_collector - each thread's fates run newest first, exactly once, serially or in parallel, and across more collectors than the per-thread cache holds
+	{
+		std::cerr << "concurrent_fate_collector\n";
+		std::vector<std::vector<int>> logs(4);
+		auto lifo_once = [&]
+		{
+			bool ok = true;
+			for (auto &log : logs)
+			{
+				ok = ok && log.size() == 100;
+				for (std::size_t i = 0; ok && i < log.size(); ++i) ok = log[i] == 99 - (int)i;
+				log.clear();
+			}
+			return ok;
+		};
+		auto fill = [&](concurrent_fate_collector &collector)
+		{
+			std::vector<std::thread> threads;
+			for (int t = 0; t < 4; ++t) threads.emplace_back([&, t]
+			{
+				for (int i = 0; i < 100; ++i)
+				{
+					if (i % 10) collector.add([&logs, t, i] { logs[t].push_back(i); });
+					else collector.add([&logs, t, i, pad = std::string(200, 'x')] { (void)pad; logs[t].push_back(i); }); // too big to store inline
+				}
+			});
+			for (auto &t : threads) t.join();
+		};
+
+		concurrent_fate_collector collector;
+		fill(collector);
+		collector.run_all();
+		smoke_check(lifo_once(), "serial run_all invokes each thread's fates newest first, exactly once");
+		fill(collector);
+		collector.run_all(true);
+		smoke_check(lifo_once(), "parallel run_all invokes each thread's fates newest first, exactly once");
+		fill(collector);
+		collector.release();
+		collector.run_all();
+		smoke_check(std::all_of(logs.begin(), logs.end(), [](const std::vector<int> &log) { return log.empty(); }), "released fates are never invoked");
+
+		// one thread alternating between more collectors than its cache holds
+		int ran = 0;
+		{
+			std::vector<std::unique_ptr<concurrent_fate_collector>> many;
+			for (int i = 0; i < 6; ++i) many.push_back(std::make_unique<concurrent_fate_collector>());
+			for (int round = 0; round < 10; ++round) for (auto &c : many) c->add([&] { ++ran; });
+			std::size_t exact = 0;
+			for (auto &c : many)
+			{
+				const int before = ran;
+				c->run_all();
+				if (ran - before == 10) ++exact;
+			}
+			smoke_check(exact == many.size(), "cache misses find the thread's existing segment in each collector");
+		}
+		smoke_check(ran == 60, "every collector ran its fates exactly once");
+	}
+
+
+	// signal_cleanup_registry / signal_fate - drain runs armed entries newest first and exactly once (even from racing threads), release disarms
+	{
+		std::cerr << "signal_cleanup\n";
+		struct mark_ctx { std::atomic<int> *runs; std::vector<int> *log; int id; };
+		auto mark = [](void *p) { mark_ctx &c = *static_cast<mark_ctx*>(p); ++*c.runs; if (c.log) c.log->push_back(c.id); };
+
+		std::atomic<int> runs{0};
+		std::vector<int> log;
+		mark_ctx ctx[4] = { { &runs, &log, 1 }, { &runs, &log, 2 }, { &runs, &log, 3 }, { &runs, &log, 4 } };
+
+		signal_cleanup_registry<4> registry;
+		auto a = registry.arm(mark, &ctx[0]);
+		auto b = registry.arm(mark, &ctx[1]);
+		auto c = registry.arm(mark, &ctx[2]);
+		auto d = registry.arm(mark, &ctx[3]);
+		smoke_check(!registry.arm(mark, &ctx[0]), "arming fails once the registry is full");
+		smoke_check(registry.release(b) && !registry.release(b), "release disarms an entry exactly once");
+		smoke_check(registry.run(c) && !registry.run(c), "run invokes an entry exactly once");
+		registry.drain();
+		registry.drain();
+		smoke_check(log == std::vector<int>({ 3, 4, 1 }) && registry.size() == 0, "drain runs what's still armed newest first, exactly once");
+		smoke_check(!registry.release(a) && !registry.run(d), "stale handles do nothing");
+
+		// several threads draining at once (as when multiple threads crash)
+		runs = 0;
+		mark_ctx counted{ &runs, nullptr, 0 };
+		for (int round = 0; round < 100; ++round)
+		{
+			for (std::size_t i = 0; i < registry.capacity(); ++i) registry.arm(mark, &counted);
+			std::vector<std::thread> drainers;
+			for (int t = 0; t < 4; ++t) drainers.emplace_back([&] { registry.drain(); });
+			for (auto &t : drainers) t.join();
+		}
+		smoke_check(runs == 400, "racing drains run every entry exactly once");
+
+		runs = 0;
+		{
+			auto invoked = make_signal_fate(mark, &counted);
+			auto released = make_signal_fate(mark, &counted);
+			auto drained = make_signal_fate(mark, &counted);
+			invoked();
+			released.release();
+			smoke_check(signal_cleanups.size() == 1, "invoking or releasing a signal_fate disarms it");
+			signal_cleanups.drain();
+			smoke_check(runs == 2 && drained, "a drain runs the armed signal_fate");
+		}
+		smoke_check(runs == 2, "a drained signal_fate doesn't run again on destruction");
+
+#if defined(__unix__) || defined(__APPLE__)
+		// a real signal, in a forked child (the handler re-raises, so the child dies by the signal after the cleanup has run)
+		int fds[2];
+		if (pipe(fds) == 0)
+		{
+			const pid_t pid = fork();
+			if (pid == 0)
+			{
+				close(fds[0]);
+				install_signal_cleanup_handlers({ SIGTERM });
+				auto cleanup = make_signal_fate([](void *fd) { (void)!write((int)(std::intptr_t)fd, "x", 1); }, (void*)(std::intptr_t)fds[1]);
+				std::raise(SIGTERM);
+				std::_Exit(0);
+			}
+			close(fds[1]);
+			std::string got;
+			char ch;
+			while (read(fds[0], &ch, 1) == 1) got += ch;
+			close(fds[0]);
+			int status = 0;
+			waitpid(pid, &status, 0);
+			smoke_check(got == "x" && WIFSIGNALED(status) && WTERMSIG(status) == SIGTERM, "a signal drains signal_fates, then kills the process as usual");
+		}
+#endif
+	}
+
+
+	// robust_fate_table - records of dead owners are reaped exactly once (even by racing supervisors), released ones never, live owners' never
+	{
+		std::cerr << "robust_fate_table\n";
+		typedef robust_fate_table<robust_fate_record, 64> table_t;
+		std::atomic<int> reaped{0};
+		auto run = [&](std::uint32_t, const robust_fate_record &r) { reaped += (int)r.op; };
+
+		{
+			table_t table;
+			for (int round = 0; round < 50; ++round)
+			{
+				for (std::size_t i = 0; i < table.capacity(); ++i) table.arm(1000 + (std::uint32_t)(i % 4), robust_fate_record{ 1, {} });
+				std::vector<std::thread> supervisors;
+				for (int t = 0; t < 4; ++t) supervisors.emplace_back([&] { for (std::uint32_t pid = 1000; pid < 1004; ++pid) table.reap_pid(pid, run); });
+				for (auto &t : supervisors) t.join();
+			}
+			smoke_check(reaped == 50 * 64 && table.size() == 0, "racing supervisors reap every record exactly once");
+
+			reaped = 0;
+			auto kept = table.arm(1, robust_fate_record{ 1, {} });
+			auto dropped = table.arm(2, robust_fate_record{ 1, {} });
+			table.arm(2, robust_fate_record{ 1, {} });
+			smoke_check(table.release(dropped) && !table.release(dropped), "releasing a record works exactly once");
+			smoke_check(table.reap_dead([](std::uint32_t pid) { return pid == 1; }, run) == 1 && reaped == 1, "reap_dead only reaps the records of dead owners");
+			smoke_check(table.release(kept) && table.size() == 0, "a live owner's record is untouched by reaping");
+		}
+
+#if defined(__unix__) || defined(__APPLE__)
+		// a worker process that dies without cleaning up: its local fates never run, so the supervisor reaps its records
+		void *mem = mmap(nullptr, sizeof(table_t), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+		if (mem != MAP_FAILED)
+		{
+			table_t &table = *new (mem) table_t;
+			const pid_t pid = fork();
+			if (pid == 0)
+			{
+				const std::uint32_t self = (std::uint32_t)getpid();
+				auto done = make_robust_fate(table, self, robust_fate_record{ 10, {} }, [] {});
+				auto abandoned = make_robust_fate(table, self, robust_fate_record{ 20, {} }, [] {});
+				auto left = make_robust_fate(table, self, robust_fate_record{ 100, {} }, [] {});
+				auto also_left = make_robust_fate(table, self, robust_fate_record{ 1000, {} }, [] {});
+				done();
+				abandoned.release();
+				std::_Exit(0); // dies without running its destructors
+			}
+			waitpid(pid, nullptr, 0);
+			reaped = 0;
+			smoke_check(table.reap_pid((std::uint32_t)pid, run) == 2 && reaped == 1100, "the records a dead worker left armed are reaped (and only those)");
+			smoke_check(table.reap_pid((std::uint32_t)pid, run) == 0 && table.size() == 0, "reaped records are not reaped again");
+			munmap(mem, sizeof(table_t));
+		}
+#endif
+	}
+
+
+#if defined(__unix__) || defined(__APPLE__)
+	// atomic_file_batch - a destroyed (uncommitted) batch rolls back, a discarded file is left alone, a commit replaces every other file
+	{
+		std::cerr << "atomic_file_batch\n";
+		const std::string a = "fate_smoke_batch_a.txt", b = "fate_smoke_batch_b.txt";
+		auto slurp = [](const std::string &path) { std::ifstream f(path); return std::string(std::istreambuf_iterator<char>(f), std::istreambuf_iterator<char>()); };
+		auto leftover_temps = [&]
+		{
+			std::size_t n = 0;
+			for (const auto &e : std::filesystem::directory_iterator(".")) n += e.path().filename().string().find("fate_smoke_batch_") == 0 && e.path().filename().string().find(".tmp.") != std::string::npos;
+			return n;
+		};
+		std::ofstream(a) << "old a";
+		std::ofstream(b) << "old b";
+
+		{
+			atomic_file_batch batch;
+			batch.write(batch.add(a), "new a");
+			batch.write(batch.add(b), "new b");
+			smoke_check(leftover_temps() == 2 && slurp(a) == "old a", "files are written to temp files until commit");
+		}
+		smoke_check(slurp(a) == "old a" && slurp(b) == "old b" && leftover_temps() == 0, "an uncommitted batch is rolled back on destruction");
+
+		for (batch_sync mode : { batch_sync::batched, batch_sync::filesystem })
+		{
+			atomic_file_batch batch(mode);
+			const std::size_t ia = batch.add(a), ib = batch.add(b);
+			batch.write(ia, mode == batch_sync::batched ? "batched a" : "filesystem a");
+			batch.write(ib, "discarded b");
+			batch.discard(ib);
+			batch.commit();
+			smoke_check(batch.empty() && leftover_temps() == 0, "commit leaves no temp files behind");
+		}
+		smoke_check(slurp(a) == "filesystem a" && slurp(b) == "old b", "commit replaces every pending file, and leaves discarded ones alone");
+
+		std::remove(a.c_str());
+		std::remove(b.c_str());
+	}
+#endif
+
+
+#if defined(__unix__) || defined(__APPLE__)
+	// fd_teardown_batch / mapping_teardown_batch - everything handed over is closed (unmapped) exactly when the batch is flushed, released fates hand nothing over
+	{
+		std::cerr << "teardown_batch\n";
+		auto is_open = [](int fd) { return fcntl(fd, F_GETFD) != -1; };
+		auto is_mapped = [](void *addr) { return msync(addr, 1, MS_ASYNC) == 0; };
+
+		std::vector<int> fds;
+		for (int i = 0; i < 16; ++i) fds.push_back(open("/dev/null", O_RDONLY | O_CLOEXEC));
+		int kept = -1;
+		{
+			fd_teardown_batch batch;
+			{
+				std::vector<fate<batched_close>> closers;
+				for (int fd : fds) closers.push_back(make_batched_close_fate(batch, fd));
+				kept = fds.back();
+				closers.back().release();
+			}
+			smoke_check(batch.size() == 15 && std::all_of(fds.begin(), fds.end(), is_open), "batched close fates hand their descriptors to the batch without closing them");
+			batch.flush();
+			smoke_check(batch.empty() && std::none_of(fds.begin(), fds.end() - 1, is_open), "flushing the batch closes every descriptor");
+		}
+		smoke_check(is_open(kept), "a released batched close fate leaves its descriptor alone");
+		close(kept);
+
+		const std::size_t page = (std::size_t)sysconf(_SC_PAGESIZE);
+		std::vector<void*> maps;
+		for (int i = 0; i < 8; ++i) maps.push_back(mmap(nullptr, page, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
+		{
+			mapping_teardown_batch batch;
+			for (void *m : maps) make_batched_unmap_fate(batch, m, page);
+			smoke_check(batch.size() == 8 && std::all_of(maps.begin(), maps.end(), is_mapped), "batched unmap fates hand their mappings to the batch without unmapping them");
+		}
+		smoke_check(std::none_of(maps.begin(), maps.end(), is_mapped), "a destroyed mapping batch unmaps everything (adjacent or not)");
+	}
+#endif
+
+
+	// reclaim_registry - reclaims in rank order until the request is met, each fate exactly once; withdrawn fates never run
+	{
+		std::cerr << "reclaim_registry\n";
+		std::mutex mutex;
+		std::vector<int> order;
+		auto mark = [&](int id) { return [&, id] { std::lock_guard<std::mutex> lock(mutex); order.push_back(id); }; };
+
+		{
+			reclaim_registry registry;
+			registry.add(mark(3), 2, 100).detach(); // left for the registry's destructor
+			auto hot = registry.add(mark(1), 0, 100);
+			auto warm = registry.add(make_fate(mark(2)), 1, 100);
+			auto dropped = registry.add(mark(4), 0, 100);
+			dropped.withdraw();
+			smoke_check(registry.size() == 3 && registry.bytes() == 300, "withdrawing a ticket unregisters its fate");
+
+			smoke_check(registry.reclaim(150) == 200 && order == std::vector<int>({ 1, 2 }), "reclaim invokes the lowest ranks first until the request is met");
+			smoke_check(!hot.pending() && !warm.pending() && registry.size() == 1, "reclaimed fates are no longer pending");
+		}
+		smoke_check(order == std::vector<int>({ 1, 2, 3 }), "a destroyed registry invokes what's left (and never a withdrawn fate)");
+
+		// racing reclaims (and a monitor) still run everything exactly once
+		std::atomic<int> ran{0};
+		{
+			reclaim_registry registry;
+			std::vector<reclaim_registry::ticket> tickets;
+			for (int i = 0; i < 1000; ++i) tickets.push_back(registry.add([&] { ++ran; }, i % 7, 1));
+			std::atomic<bool> pressure{true};
+			reclaim_monitor monitor(registry, [&]() -> std::size_t { return pressure ? 10 : 0; }, std::chrono::milliseconds(1));
+			std::vector<std::thread> reclaimers;
+			for (int t = 0; t < 4; ++t) reclaimers.emplace_back([&] { while (registry.reclaim(1)) {} });
+			for (auto &t : reclaimers) t.join();
+			pressure = false;
+		}
+		smoke_check(ran == 1000, "racing reclaims invoke every fate exactly once");
+	}
+
+
+	// scope_success / scope_failure - invoked or released depending on how the scope is left, alone or sharing a scope_group's sample
+	{
+		std::cerr << "scope_success / scope_failure\n";
+		std::string log;
+		auto leave = [&](bool by_exception)
+		{
+			log.clear();
+			try
+			{
+				scope_group group;
+				auto grouped_success = make_scope_success(group, [&] { log += 'S'; });
+				auto grouped_failure = make_scope_failure(group, [&] { log += 'F'; });
+				auto success = make_scope_success([&] { log += 's'; });
+				auto failure = make_scope_failure([&] { log += 'f'; });
+				auto released = make_scope_failure([&] { log += 'x'; });
+				released.release();
+				if (by_exception) throw std::runtime_error("leaving");
+			}
+			catch (const std::runtime_error&) {}
+			return log;
+		};
+		smoke_check(leave(false) == "sS", "a scope left normally invokes only the success guards (grouped or not)");
+		smoke_check(leave(true) == "fF", "a scope left by an exception invokes only the failure guards (grouped or not)");
+
+		// a scope that exits normally while another exception is already in flight (i.e. inside a destructor during unwinding)
+		struct unwinding_probe
+		{
+			std::string &log;
+			~unwinding_probe()
+			{
+				scope_group group;
+				auto success = make_scope_success(group, [this] { log += 'S'; });
+				auto failure = make_scope_failure([this] { log += 'f'; });
+			}
+		};
+		log.clear();
+		try
+		{
+			unwinding_probe probe{ log };
+			throw std::runtime_error("unwinding");
+		}
+		catch (const std::runtime_error&) {}
+		smoke_check(log == "S", "guards created during unwinding only count exceptions thrown after them");
+	}
+
+
+	// rollback_guard - rolls back unless released, exactly once, and a moved-from guard is disarmed
+	{
+		std::cerr << "rollback_guard\n";
+		int rolled_back = 0;
+		auto transaction = [&](bool succeed)
+		{
+			auto undo = make_rollback_guard([&] { ++rolled_back; });
+			if (succeed) undo.release();
+		};
+		transaction(true);
+		smoke_check(rolled_back == 0, "a released rollback_guard never runs");
+		transaction(false);
+		smoke_check(rolled_back == 1, "an armed rollback_guard runs at scope exit");
+
+		{
+			auto undo = make_rollback_guard([&] { ++rolled_back; });
+			auto moved = std::move(undo);
+			smoke_check(!undo && moved, "moving a rollback_guard transfers the contract");
+			moved();
+			smoke_check(rolled_back == 2 && !moved, "invoking a rollback_guard runs it and disarms it");
+		}
+		smoke_check(rolled_back == 2, "an invoked (or moved-from) rollback_guard doesn't run again");
+	}
+
+
+	// unique_resource - the deleter runs exactly once for an owned handle, never for the invalid value or a released handle
+	{
+		std::cerr << "unique_resource\n";
+		typedef unique_resource<int, &smoke_delete_handle, -1> handle_t;
+		static_assert(sizeof(handle_t) == sizeof(int), "unique_resource is just the handle");
+		{
+			handle_t zero(0); // 0 is a valid handle here - only -1 means empty
+			handle_t none(-1);
+			handle_t kept(2);
+			handle_t moved(3);
+			handle_t target(std::move(moved));
+			smoke_check(zero && !none && !moved && target.get() == 3, "the invalid value (and only it) means empty, and moving transfers the handle");
+			smoke_check(kept.release() == 2 && !kept, "release gives up the handle without deleting it");
+			target.reset(4);
+			smoke_check(smoke_deleted_handles == std::vector<int>({ 3 }), "reset deletes the old handle");
+		}
+		smoke_check(smoke_deleted_handles == std::vector<int>({ 3, 4, 0 }), "owned handles are deleted exactly once on destruction");
+
+		{
+			unique_resource<int*, &smoke_delete_pointer> owned(new int(1)), empty;
+			smoke_check(owned && !empty, "pointer handles default to nullptr as the invalid value");
+			owned();
+			smoke_check(smoke_deleted_pointers == 1 && !owned, "invoking deletes the handle and empties the unique_resource");
+		}
+		smoke_check(smoke_deleted_pointers == 1, "an invoked unique_resource doesn't delete again");
+	}
+
+
+	// fate<T(*)(C*)> - a function pointer plus a context pointer, invoked exactly once unless released, with exceptions swallowed
+	{
+		std::cerr << "fate (function pointer with context)\n";
+		int count = 0;
+		{
+			auto bump = make_fate(+[](int *n) { ++*n; }, &count);
+			auto released = make_fate(+[](int *n) { ++*n; }, &count);
+			auto throws = make_fate(+[](int*) { throw std::runtime_error("swallowed"); }, &count);
+			auto freed = make_fate(std::free, std::malloc(16)); // any object pointer converts to void*
+			smoke_check(bump.context() == &count && freed, "make_fate binds a function and its context");
+
+			released.release();
+			auto moved = std::move(bump);
+			smoke_check(!bump && moved && !released, "moving transfers the contract and release abandons it");
+			moved();
+			smoke_check(count == 1 && !moved, "invoking calls the function with its context and empties the fate");
+		}
+		smoke_check(count == 1, "released, moved-from and invoked fates don't run again (and throwing ones are swallowed)");
+	}
+
+
+#if __cplusplus >= 202002L
+	// fate_stats / fate_timing - per-site counts and latency samples, merged across threads (including ones that have exited)
+	{
+		std::cerr << "fate_stats / fate_timing\n";
+		fate_timing::set_sample_rate(1);
+		const std::uint_least32_t line = __LINE__ + 1;
+		auto spawn = [](bool ok) { return make_fate([ok] { if (!ok) throw std::runtime_error("swallowed"); }); };
+
+		std::vector<std::thread> threads;
+		for (int t = 0; t < 4; ++t) threads.emplace_back([&]
+		{
+			for (int i = 0; i < 100; ++i) { auto f = spawn(true); }
+			for (int i = 0; i < 50; ++i) { auto f = spawn(true); f.release(); }
+			for (int i = 0; i < 10; ++i) { auto f = spawn(false); }
+		});
+		for (auto &t : threads) t.join();
+		fate_timing::set_sample_rate(64);
+
+		auto here = [&](const auto &s) { return s.line == line && s.file.find("main.cpp") != std::string::npos; };
+		const auto counts = fate_stats::snapshot();
+		const auto it = std::find_if(counts.begin(), counts.end(), here);
+		smoke_check(it != counts.end() && it->created == 640 && it->invoked == 440 && it->released == 200 && it->swallowed == 40, "fate_stats counts every event at the site, from every thread");
+
+		const auto timings = fate_timing::snapshot();
+		const auto jt = std::find_if(timings.begin(), timings.end(), here);
+		smoke_check(jt != timings.end() && jt->samples == 440 && jt->p50 <= jt->p99 && jt->p99 <= jt->max, "fate_timing samples every invocation at the site at a sample rate of 1");
+	}
+#endif
+
+#if __cplusplus >= 202002L && DRAGAZO_SDT_AVAILABLE && defined(__linux__)
+	// usdt probes - every probe site is described by a note in the binary (which is where tracers look for them)
+	{
+		std::cerr << "usdt probes\n";
+		std::ifstream exe("/proc/self/exe", std::ios::binary);
+		const std::string image((std::istreambuf_iterator<char>(exe)), std::istreambuf_iterator<char>());
+		auto has_probe = [&](const char *name) { return image.find(std::string("fate") + '\0' + name + '\0') != std::string::npos; };
+		smoke_check(image.find("stapsdt") != std::string::npos, "the binary has usdt notes");
+		smoke_check(has_probe("arm") && has_probe("invoke") && has_probe("release") && has_probe("transfer"), "fate:arm, fate:invoke, fate:release and fate:transfer are all there");
+	}
+#endif
+
+
+	std::cerr << '\n' << smoke_failures << " smoke check(s) failed\n";
+
 	std::cin.get();
-	return 0;
+	return smoke_failures ? 1 : 0;
 }
@@ -0,0 +1,318 @@
+#ifndef DRAGAZO_OWNER_FATE_H
+#define DRAGAZO_OWNER_FATE_H
+
+#include <atomic>
+#include <cstddef>
+#include <utility>
+#include <type_traits>
+
+#include "fate.h"
+
+// owner_fate is a fate variant that remembers the thread that created it (its "owner").
+// if it is invoked (or destroyed) on the owner thread, it behaves exactly like a fate.
+// if it is invoked (or destroyed) on any other thread, it does not run its function there - instead it pushes itself onto the owner's remote-free queue.
+// the owner thread later runs everything in its queue at a safe point of its choosing via drain_remote_fates().
+// this is the same pattern mimalloc uses for cross-thread frees: memory taken from a thread-local pool always goes back on the thread that owns the pool.
+// unlike fate, owner_fate makes one dynamic allocation (on the owner thread) to hold its function-like object, so that the object can outlive the owner_fate instance while queued.
+
+// intrusive node for a remote_free_queue.
+// the queue never allocates - whatever is pushed onto it is responsible for its own storage and for disposing of itself when run.
+struct remote_free_node
+{
+	std::atomic<remote_free_node*> next{nullptr};
+
+	// runs (if run is true) and then destroys/deallocates the node.
+	// this is only ever called on the thread that drains the queue, which then drops the node's queue reference.
+	void (*dispose)(remote_free_node *node, bool run) noexcept = nullptr;
+
+	// marks if dispose should invoke the node or just destroy it.
+	bool run = true;
+};
+
+// a multi-producer single-consumer queue of remote_free_node, one per thread.
+// push() is wait-free (a fixed handful of atomic operations, no retry loops) and can be called from any thread.
+// drain() is only ever called by one thread at a time (normally the owner).
+// queues are reference counted so they can safely outlive their owner thread while remote nodes are still in flight.
+class remote_free_queue
+{
+private: // -- data -- //
+
+	// vyukov intrusive mpsc queue: producers exchange tail, the consumer walks from head.
+	// stub is a permanently-owned dummy node so that the queue is never truly empty.
+	std::atomic<remote_free_node*> tail;
+	remote_free_node *head;
+	remote_free_node stub;
+
+	// one reference for the owner thread, plus one for every live owner_fate bound to this queue.
+	std::atomic<std::size_t> refs{1};
+
+	// set once the owner thread has exited - after this point pushers must drain the queue themselves.
+	std::atomic<bool> orphaned{false};
+
+	// guards drain() so that only one thread ever consumes at a time (uncontended unless orphaned).
+	std::atomic<bool> draining{false};
+
+	// the queue owned by the calling thread (null if it has none or has already exited).
+	// this is a raw pointer (trivially destructible) so it stays valid to read during thread_local destruction.
+	static remote_free_queue *&current() noexcept
+	{
+		static thread_local remote_free_queue *q = nullptr;
+		return q;
+	}
+
+	// owns the calling thread's queue and orphans it on thread exit
+	struct holder
+	{
+		remote_free_queue *q = new remote_free_queue;
+
+		holder() noexcept { current() = q; }
+		~holder()
+		{
+			current() = nullptr;
+			q->orphaned.store(true);
+			q->unref(q->collect() + 1);
+		}
+	};
+
+	remote_free_queue() noexcept : tail(&stub), head(&stub) {}
+
+	// pops a single node, or returns null if there is nothing (fully linked) to pop.
+	// WARNING - must hold draining.
+	remote_free_node *pop() noexcept
+	{
+		remote_free_node *h = head;
+		remote_free_node *n = h->next.load(std::memory_order_acquire);
+
+		// skip over the stub node
+		if (h == &stub)
+		{
+			if (!n) return nullptr;
+			head = h = n;
+			n = n->next.load(std::memory_order_acquire);
+		}
+		// common case - there's a node after this one, so this one is safe to take
+		if (n)
+		{
+			head = n;
+			return h;
+		}
+		// h looks like the last node - if a producer is mid-push we have to leave it for later
+		if (h != tail.load(std::memory_order_acquire)) return nullptr;
+
+		// re-insert the stub so that h can be taken
+		enqueue(&stub);
+		n = h->next.load(std::memory_order_acquire);
+		if (n)
+		{
+			head = n;
+			return h;
+		}
+		return nullptr;
+	}
+
+	void enqueue(remote_free_node *node) noexcept
+	{
+		node->next.store(nullptr, std::memory_order_relaxed);
+		remote_free_node *prev = tail.exchange(node);
+		// between the exchange and this store the queue is briefly disconnected - pop() copes with that
+		prev->next.store(node, std::memory_order_release);
+	}
+
+	// drains until the queue is observed empty while nobody else is draining.
+	// used once the owner is gone, where any pusher may have to do the owner's job.
+	// returns the number of nodes disposed of (the caller owes that many unref()s).
+	std::size_t collect() noexcept
+	{
+		std::size_t count = 0;
+		while (try_drain(count) && !empty()) {}
+		return count;
+	}
+
+	// drains if no other thread is currently draining. returns false if another thread held the drain.
+	// the number of nodes disposed of is added to count.
+	bool try_drain(std::size_t &count) noexcept
+	{
+		if (draining.exchange(true)) return false;
+		for (remote_free_node *node; (node = pop()); ++count) node->dispose(node, node->run);
+		draining.store(false);
+		return true;
+	}
+
+	bool empty() const noexcept
+	{
+		return tail.load() == &stub && stub.next.load() == nullptr;
+	}
+
+public: // -- interface -- //
+
+	remote_free_queue(const remote_free_queue&) = delete;
+	remote_free_queue &operator=(const remote_free_queue&) = delete;
+
+	// gets the calling thread's queue, creating it on first use.
+	// returns null if called during (or after) the calling thread's thread_local destruction.
+	static remote_free_queue *local() noexcept
+	{
+		if (remote_free_queue *q = current()) return q;
+		static thread_local holder h;
+		return current();
+	}
+
+	// returns true iff this queue belongs to the calling thread
+	bool owned() const noexcept { return current() == this; }
+
+	// pushes a node to be disposed of by the owner thread. safe to call from any thread.
+	// if the owner thread has already exited, the node is disposed of on the calling thread instead.
+	void push(remote_free_node *node) noexcept
+	{
+		// keep ourselves alive until we're done looking at the queue (node may be disposed of by someone else immediately)
+		ref();
+		enqueue(node);
+		// the owner is gone, so there's nobody else to run it
+		unref((orphaned.load() ? collect() : 0) + 1);
+	}
+
+	// runs every node currently in the queue. this should only be called by the owner thread.
+	// returns the number of nodes that were disposed of.
+	std::size_t drain() noexcept
+	{
+		std::size_t count = 0;
+		try_drain(count);
+		unref(count);
+		return count;
+	}
+
+	// every pushed node must hold a reference, which is dropped by whoever disposes of it
+	void ref() noexcept { refs.fetch_add(1, std::memory_order_relaxed); }
+	void unref(std::size_t count = 1) noexcept
+	{
+		// every queued node holds a reference, so if this hits zero the queue is empty and nobody can push anymore
+		if (count && refs.fetch_sub(count, std::memory_order_acq_rel) == count) delete this;
+	}
+};
+
+// runs all the owner_fate objects that other threads have handed back to the calling thread.
+// call this at a safe point (e.g. between tasks, at the top of an event loop, before allocating from a thread-local pool).
+// returns the number of queued fates that were disposed of.
+inline std::size_t drain_remote_fates() noexcept
+{
+	remote_free_queue *q = remote_free_queue::local();
+	return q ? q->drain() : 0;
+}
+
+// -------------------------------------------------------------- //
+
+template<typename T>
+class owner_fate
+{
+private: // -- data -- //
+
+	// heap storage for the function-like object - this is what gets pushed onto the owner's queue
+	struct node : remote_free_node
+	{
+		// null if created during the owner thread's exit (in which case there is nobody to route back to)
+		remote_free_queue *owner;
+		fate<T> func;
+
+		template<typename J>
+		node(remote_free_queue *o, J &&arg) : owner(o), func(std::forward<J>(arg)) { dispose = &dispose_node; }
+
+		// WARNING - does not drop the owner reference (the caller is responsible for that)
+		static void dispose_node(remote_free_node *base, bool run) noexcept
+		{
+			node *self = static_cast<node*>(base);
+			if (run) self->func();
+			else self->func.release();
+			delete self;
+		}
+	};
+
+	// the bound function (or null if empty)
+	node *n;
+
+	// runs or discards the node - inline if we're on the owner thread, otherwise via the owner's queue
+	void finish(bool run) noexcept
+	{
+		if (node *_n = n)
+		{
+			// mark that we're empty (so that if the function calls this function we don't call it multiple times)
+			n = nullptr;
+
+			remote_free_queue *owner = _n->owner;
+			if (!owner || owner->owned())
+			{
+				node::dispose_node(_n, run);
+				if (owner) owner->unref();
+			}
+			else
+			{
+				_n->run = run;
+				owner->push(_n);
+			}
+		}
+	}
+
+public: // -- ctor / dtor / asgn -- //
+
+	// creates an owner_fate object that is not associated with a function object (empty)
+	constexpr owner_fate() noexcept : n(nullptr) {}
+
+	// creates an owner_fate object for the given function-like object, owned by the calling thread.
+	// the argument will be forwarded to the T constructor.
+	// on failure, the created instance is guaranteed to be empty and an exception is thrown.
+	template<typename J>
+	explicit owner_fate(J &&arg) : n(nullptr)
+	{
+		remote_free_queue *q = remote_free_queue::local();
+		node *_n = new node(q, std::forward<J>(arg));
+		if (q) q->ref();
+		n = _n;
+	}
+
+	~owner_fate() { (*this)(); }
+
+	owner_fate(const owner_fate&) = delete;
+	owner_fate &operator=(const owner_fate&) = delete;
+
+	// constructs a new owner_fate object by transfering other's contract to the new instance (the owner does not change)
+	owner_fate(owner_fate &&other) noexcept : n(other.n) { other.n = nullptr; }
+	// if this instance currently holds a function, it is triggered. after this, other's contract is transfered to this instance.
+	// in the special case of self-assignment, does nothing.
+	owner_fate &operator=(owner_fate &&other) noexcept
+	{
+		if (this != &other)
+		{
+			(*this)();
+			n = other.n;
+			other.n = nullptr;
+		}
+		return *this;
+	}
+
+public: // -- utilities -- //
+
+	// triggers the stored function (if any). on the owner thread it is called immediately.
+	// on any other thread it is queued for the owner, which calls it at its next drain_remote_fates().
+	// if the function-like object throws an exception, it is caught and ignored.
+	// the resulting owner_fate object is guaranteed to be empty after this.
+	void operator()() noexcept { finish(true); }
+
+	// abandons the function (will no longer be executed). the function-like object is still destroyed on the owner thread.
+	void release() noexcept { finish(false); }
+
+	// returns true iff this object is still associated with a function object
+	explicit operator bool() const noexcept { return n; }
+	// returns true iff this object is not associated with a function object
+	bool operator!() const noexcept { return !n; }
+
+	// returns true iff this object is not associated with a function object
+	bool empty() const noexcept { return !n; }
+
+	// returns true iff this object is bound to a function and the calling thread is its owner
+	bool owned() const noexcept { return n && n->owner && n->owner->owned(); }
+};
+
+// creates an owner_fate object (owned by the calling thread) from the given function-like object
+template<typename T>
+auto make_owner_fate(T &&arg) { return owner_fate<std::decay_t<T>>{std::forward<T>(arg)}; }
+
+#endif
@@ -0,0 +1,103 @@
+#ifndef DRAGAZO_PARALLEL_DESTROY_H
+#define DRAGAZO_PARALLEL_DESTROY_H
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <iterator>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "fate.h"
+
+// parallel_destroy takes ownership of a (random access) container and destroys its elements on several threads at once.
+// the elements are split into chunks which worker threads claim from a shared counter, so uneven destruction costs still balance out.
+// each element is destroyed by moving it into a temporary that dies on the worker thread (e.g. for a unique_ptr, the pointee is deleted there).
+// the moved-from shells (cheap to destroy) and the container's own storage are then released on the calling thread.
+// this only pays off for elements that own something expensive to free - for trivially destructible elements, the container is just destroyed normally.
+
+// options for parallel_destroy
+struct parallel_destroy_options
+{
+	// number of threads to use (including the calling thread). zero uses std::thread::hardware_concurrency().
+	std::size_t threads = 0;
+	// number of elements each worker claims at a time. no more threads are used than there are chunks.
+	std::size_t chunk = 4096;
+};
+
+// destroys the elements of c in parallel, then c itself. c is left empty (moved-from).
+// blocks until all elements have been destroyed. exceptions thrown by element destructors are not supported (they should be noexcept anyway).
+// the container must be nothrow move constructible (so taking ownership of it can't fail).
+// if worker threads cannot be created (std::thread throws), the work they would have done is picked up by the calling thread instead.
+template<typename Container>
+void parallel_destroy(Container &&c, parallel_destroy_options opt = {}) noexcept
+{
+	static_assert(!std::is_lvalue_reference<Container>::value || !std::is_const<std::remove_reference_t<Container>>::value, "cannot destroy a const container");
+	typedef std::decay_t<Container> container_t;
+	typedef typename container_t::value_type value_t;
+	static_assert(std::is_nothrow_move_constructible<container_t>::value, "parallel_destroy requires a nothrow move constructible container");
+	static_assert(std::is_nothrow_move_constructible<value_t>::value, "parallel_destroy requires nothrow move constructible elements");
+	static_assert(std::is_base_of<std::random_access_iterator_tag, typename std::iterator_traits<typename container_t::iterator>::iterator_category>::value, "parallel_destroy requires a random access container");
+
+	// take ownership so c is left empty no matter how we get here
+	container_t victim(std::move(c));
+
+	if constexpr (!std::is_trivially_destructible<value_t>::value)
+	{
+		const std::size_t size = victim.size();
+		const std::size_t chunk = std::max<std::size_t>(opt.chunk, 1);
+		const std::size_t chunks = (size + chunk - 1) / chunk;
+
+		std::size_t threads = opt.threads ? opt.threads : std::thread::hardware_concurrency();
+		threads = std::min<std::size_t>(std::max<std::size_t>(threads, 1), chunks);
+
+		auto begin = std::begin(victim);
+		std::atomic<std::size_t> next{0};
+		auto work = [&]() noexcept
+		{
+			for (std::size_t i; (i = next.fetch_add(1, std::memory_order_relaxed)) < chunks; )
+			{
+				auto it = begin + i * chunk;
+				auto end = begin + std::min(size, (i + 1) * chunk);
+				for (; it != end; ++it) { value_t dead(std::move(*it)); }
+			}
+		};
+
+		std::vector<std::thread> workers;
+		if (threads > 1)
+		{
+			try
+			{
+				workers.reserve(threads - 1);
+				for (std::size_t i = 1; i < threads; ++i) workers.emplace_back(work);
+			}
+			catch (...) {} // whichever chunks the missing workers would have claimed are left for the ones we have (at worst just this thread)
+		}
+
+		work();
+		for (auto &w : workers) w.join();
+	}
+}
+
+// function-like object that calls parallel_destroy on the container it holds.
+// bind it to a fate (see make_parallel_destroy_fate()) to get a guard that tears the container down in parallel.
+template<typename Container>
+struct parallel_destroyer
+{
+	Container container;
+	parallel_destroy_options options;
+
+	void operator()() noexcept { parallel_destroy(container, options); }
+};
+
+// creates a fate object that takes ownership of c and destroys it with parallel_destroy() when invoked.
+// releasing the fate destroys the container normally (serially).
+template<typename Container>
+auto make_parallel_destroy_fate(Container &&c, parallel_destroy_options opt = {})
+{
+	return fate<parallel_destroyer<std::decay_t<Container>>>{parallel_destroyer<std::decay_t<Container>>{std::forward<Container>(c), opt}};
+}
+
+#endif
@@ -0,0 +1,380 @@
+#ifndef DRAGAZO_RECLAIM_REGISTRY_H
+#define DRAGAZO_RECLAIM_REGISTRY_H
+
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include <algorithm>
+
+#include <unistd.h>
+
+#include "fate.h"
+
+// reclaim_registry holds reclaim fates for optional memory (caches, pools, precomputed tables) that can be dropped early under memory pressure.
+// each fate is registered with a rank (lower ranks are reclaimed first - e.g. cheap-to-rebuild caches) and an estimate of how many bytes it frees.
+// reclaim(bytes) invokes fates in rank order (oldest first within a rank) until the estimates add up to the request, and a reclaim_monitor
+// can call it automatically whenever a pressure probe (psi, cgroup limits, an rss threshold, or anything else) reports pressure.
+// anything still registered when the registry is destroyed is invoked then (so a reclaim fate doubles as the cache's shutdown fate).
+// registering returns a ticket - destroying the ticket (e.g. because the cache itself is being destroyed) withdraws the fate without invoking it.
+// fates are invoked outside the registry's lock, so they may freely register new fates. all member functions are threadsafe.
+class reclaim_registry
+{
+public: // -- types -- //
+
+	class ticket;
+
+private: // -- data -- //
+
+	// type-erased fate (std::function won't do since fates are move-only)
+	struct entry_base
+	{
+		virtual ~entry_base() = default;
+		virtual void run() noexcept = 0;
+		virtual void release() noexcept = 0;
+	};
+	template<typename T>
+	struct entry_impl final : entry_base
+	{
+		fate<T> func;
+
+		explicit entry_impl(fate<T> &&f) : func(std::move(f)) {}
+
+		void run() noexcept override { func(); }
+		void release() noexcept override { func.release(); }
+	};
+
+	// entries are ordered by (rank, registration order)
+	typedef std::pair<int, std::uint64_t> key;
+
+	struct node
+	{
+		std::size_t bytes;
+		std::unique_ptr<entry_base> func;
+	};
+
+	mutable std::mutex mutex;
+	std::map<key, node> entries;
+	std::uint64_t next_seq = 0;
+
+	// entries that have been taken out by reclaim() and are being invoked right now (so tickets can wait for them)
+	std::vector<std::pair<key, std::thread::id>> running;
+	std::condition_variable finished;
+
+	// withdraws an entry (for ticket). if it's being invoked on another thread, waits for that to finish.
+	void withdraw(const key &k) noexcept
+	{
+		std::unique_ptr<entry_base> func;
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			auto it = entries.find(k);
+			if (it != entries.end())
+			{
+				func = std::move(it->second.func);
+				entries.erase(it);
+			}
+			else
+			{
+				auto is_running = [&]
+				{
+					return std::any_of(running.begin(), running.end(), [&](const std::pair<key, std::thread::id> &r) { return r.first == k && r.second != std::this_thread::get_id(); });
+				};
+				finished.wait(lock, [&] { return !is_running(); });
+			}
+		}
+		if (func) func->release();
+	}
+
+	// takes the next entry out (and marks it as running). returns false if there are none.
+	bool take(key &k, node &n)
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		if (entries.empty()) return false;
+		running.reserve(running.size() + 1); // so the emplace_back below can't throw after the entry is gone
+		auto it = entries.begin();
+		k = it->first;
+		n = std::move(it->second);
+		entries.erase(it);
+		running.emplace_back(k, std::this_thread::get_id());
+		return true;
+	}
+
+	void done_running(const key &k) noexcept
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			running.erase(std::find_if(running.begin(), running.end(), [&](const std::pair<key, std::thread::id> &r) { return r.first == k; }));
+		}
+		finished.notify_all();
+	}
+
+public: // -- ctor / dtor / asgn -- //
+
+	reclaim_registry() = default;
+
+	// invokes everything that's still registered (in rank order)
+	~reclaim_registry() { reclaim_all(); }
+
+	reclaim_registry(const reclaim_registry&) = delete;
+	reclaim_registry &operator=(const reclaim_registry&) = delete;
+
+public: // -- interface -- //
+
+	// registers a fate (which is moved from) with the given rank and size estimate, and returns the ticket that withdraws it.
+	// on failure, the fate is left untouched and an exception is thrown.
+	template<typename T>
+	ticket add(fate<T> &&f, int rank, std::size_t bytes);
+	// registers a function-like object with the given rank and size estimate, and returns the ticket that withdraws it
+	template<typename T>
+	ticket add(T &&f, int rank, std::size_t bytes);
+
+	// invokes registered fates in rank order until their estimates add up to at least bytes (or there are none left).
+	// returns the sum of the estimates of the fates that were invoked.
+	std::size_t reclaim(std::size_t bytes) noexcept
+	{
+		std::size_t freed = 0;
+		key k;
+		node n;
+		while (freed < bytes)
+		{
+			try { if (!take(k, n)) break; }
+			catch (...) { break; }
+			n.func->run();
+			n.func.reset();
+			done_running(k);
+			freed += n.bytes;
+		}
+		return freed;
+	}
+
+	// invokes every registered fate (in rank order), including any registered in the meantime. returns the sum of their estimates.
+	std::size_t reclaim_all() noexcept { return reclaim((std::size_t)-1); }
+
+	// returns the number of registered fates
+	std::size_t size() const
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		return entries.size();
+	}
+	// returns the sum of the size estimates of all registered fates
+	std::size_t bytes() const
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		std::size_t sum = 0;
+		for (auto &entry : entries) sum += entry.second.bytes;
+		return sum;
+	}
+};
+
+// withdraws a reclaim fate from its registry on destruction (without invoking it).
+// if the fate is being invoked by a reclaim on another thread at that moment, destruction waits for it to finish -
+// so once a cache's ticket is gone, its reclaim fate is guaranteed to not be running (and never run again).
+// WARNING - tickets must not outlive their registry.
+class reclaim_registry::ticket
+{
+private: // -- data -- //
+
+	friend class reclaim_registry;
+
+	reclaim_registry *registry;
+	reclaim_registry::key k;
+
+	ticket(reclaim_registry *r, reclaim_registry::key key) noexcept : registry(r), k(key) {}
+
+public: // -- ctor / dtor / asgn -- //
+
+	// creates a ticket that is not associated with anything (empty)
+	ticket() noexcept : registry(nullptr), k{} {}
+
+	~ticket() { withdraw(); }
+
+	ticket(const ticket&) = delete;
+	ticket &operator=(const ticket&) = delete;
+
+	ticket(ticket &&other) noexcept : registry(other.registry), k(other.k) { other.registry = nullptr; }
+	// withdraws this ticket's fate (if any), then takes over other's
+	ticket &operator=(ticket &&other) noexcept
+	{
+		if (this != &other)
+		{
+			withdraw();
+			registry = other.registry;
+			k = other.k;
+			other.registry = nullptr;
+		}
+		return *this;
+	}
+
+public: // -- interface -- //
+
+	// withdraws the fate now (if it hasn't been reclaimed yet, it won't be). the ticket is empty afterwards.
+	void withdraw() noexcept
+	{
+		if (registry)
+		{
+			registry->withdraw(k);
+			registry = nullptr;
+		}
+	}
+
+	// gives up control of the fate without withdrawing it: it stays registered until it is reclaimed or the registry is destroyed.
+	// (otherwise the registry's destructor never gets to invoke anything, since tickets must not outlive it.) the ticket is empty afterwards.
+	void detach() noexcept { registry = nullptr; }
+
+	// returns true iff the fate is still registered (i.e. hasn't been reclaimed or withdrawn yet)
+	bool pending() const
+	{
+		if (!registry) return false;
+		std::lock_guard<std::mutex> lock(registry->mutex);
+		return registry->entries.count(k) != 0;
+	}
+
+	// returns true iff this ticket is associated with a registry
+	explicit operator bool() const noexcept { return registry != nullptr; }
+	// returns true iff this ticket is not associated with a registry
+	bool operator!() const noexcept { return registry == nullptr; }
+};
+
+template<typename T>
+reclaim_registry::ticket reclaim_registry::add(fate<T> &&f, int rank, std::size_t bytes)
+{
+	std::unique_ptr<entry_base> func(new entry_impl<T>(std::move(f)));
+	std::lock_guard<std::mutex> lock(mutex);
+	const key k(rank, next_seq++);
+	node *n;
+	try { n = &entries[k]; }
+	catch (...)
+	{
+		// hand the fate back untouched
+		f = std::move(static_cast<entry_impl<T>*>(func.get())->func);
+		throw;
+	}
+	n->bytes = bytes;
+	n->func = std::move(func);
+	return ticket(this, k);
+}
+template<typename T>
+reclaim_registry::ticket reclaim_registry::add(T &&f, int rank, std::size_t bytes)
+{
+	auto _f = make_fate(std::forward<T>(f));
+	try { return add(std::move(_f), rank, bytes); }
+	catch (...)
+	{
+		_f.release();
+		throw;
+	}
+}
+
+// reclaim_monitor polls a pressure probe on a background thread and reclaims from a registry while the probe reports pressure.
+// the probe returns how many bytes it would like reclaimed (0 for no pressure) - it's called once per interval, so pressure that persists
+// keeps reclaiming (in rank order) tick after tick until it subsides or the registry runs dry.
+class reclaim_monitor
+{
+private: // -- data -- //
+
+	reclaim_registry &registry;
+	std::function<std::size_t()> probe;
+	std::chrono::steady_clock::duration interval;
+
+	std::mutex mutex;
+	std::condition_variable wake;
+	bool stopping = false;
+
+	std::thread worker;
+
+	void loop() noexcept
+	{
+		std::unique_lock<std::mutex> lock(mutex);
+		while (!wake.wait_for(lock, interval, [this] { return stopping; }))
+		{
+			lock.unlock();
+			std::size_t want = 0;
+			try { want = probe(); }
+			catch (...) {}
+			if (want) registry.reclaim(want);
+			lock.lock();
+		}
+	}
+
+public: // -- ctor / dtor / asgn -- //
+
+	// starts monitoring. throws on failure (e.g. if the thread can't be started).
+	reclaim_monitor(reclaim_registry &r, std::function<std::size_t()> pressure_probe, std::chrono::steady_clock::duration poll_interval = std::chrono::seconds(1))
+		: registry(r), probe(std::move(pressure_probe)), interval(poll_interval), worker([this] { loop(); })
+	{}
+
+	// stops monitoring (waits for an in-progress reclaim to finish)
+	~reclaim_monitor()
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			stopping = true;
+		}
+		wake.notify_all();
+		worker.join();
+	}
+
+	reclaim_monitor(const reclaim_monitor&) = delete;
+	reclaim_monitor &operator=(const reclaim_monitor&) = delete;
+};
+
+// -- pressure probes (linux) -- //
+
+// a probe that reports the amount by which the process's resident set size (from /proc/self/statm) exceeds limit bytes
+inline std::function<std::size_t()> rss_pressure_probe(std::size_t limit)
+{
+	return [limit]() -> std::size_t
+	{
+		std::ifstream statm("/proc/self/statm");
+		std::size_t size = 0, resident = 0;
+		if (!(statm >> size >> resident)) return 0;
+		const std::size_t rss = resident * (std::size_t)::sysconf(_SC_PAGESIZE);
+		return rss > limit ? rss - limit : 0;
+	};
+}
+
+// a probe that reports step bytes whenever the "some avg10" memory stall percentage from /proc/pressure/memory (psi) exceeds threshold
+inline std::function<std::size_t()> psi_pressure_probe(double threshold, std::size_t step)
+{
+	return [threshold, step]() -> std::size_t
+	{
+		std::ifstream psi("/proc/pressure/memory");
+		std::string kind, avg10;
+		if (!(psi >> kind >> avg10) || kind != "some" || avg10.compare(0, 6, "avg10=") != 0) return 0;
+		return std::stod(avg10.substr(6)) > threshold ? step : 0;
+	};
+}
+
+// a probe that reports the amount by which the cgroup's memory.current exceeds fraction of its limit (memory.high, or memory.max if there's no high limit).
+// cgroup is the cgroup v2 directory, e.g. "/sys/fs/cgroup" inside a container.
+inline std::function<std::size_t()> cgroup_pressure_probe(std::string cgroup = "/sys/fs/cgroup", double fraction = 0.9)
+{
+	return [cgroup = std::move(cgroup), fraction]() -> std::size_t
+	{
+		auto read = [&](const char *name) -> std::size_t
+		{
+			std::ifstream f(cgroup + "/" + name);
+			std::string value;
+			if (!(f >> value) || value == "max") return 0;
+			return (std::size_t)std::stoull(value);
+		};
+		std::size_t limit = read("memory.high");
+		if (!limit) limit = read("memory.max");
+		if (!limit) return 0;
+		const std::size_t current = read("memory.current");
+		const std::size_t target = (std::size_t)(limit * fraction);
+		return current > target ? current - target : 0;
+	};
+}
+
+#endif
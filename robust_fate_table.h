@@ -0,0 +1,297 @@
+#ifndef DRAGAZO_ROBUST_FATE_TABLE_H
+#define DRAGAZO_ROBUST_FATE_TABLE_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+#include <utility>
+#include <type_traits>
+
+#include "fate.h"
+
+// a plain-data cleanup record - an application-defined operation code plus a few argument words (e.g. a slot index, a lock id, an offset into a path table).
+// records are interpreted by the supervisor, so they must not hold pointers into any one process's address space.
+struct robust_fate_record
+{
+	std::uint32_t op = 0;
+	std::uint64_t args[4] = {};
+};
+
+// robust_fate_table is a fixed-size table of cleanup records meant to live in shared memory, so that cleanup survives the death of the process that registered it.
+// workers arm records (tagged with their pid) with lock-free slot claiming and release them once they've cleaned up themselves (or on a clean exit).
+// if a worker dies hard (kill -9, a crash), its records stay armed, and a supervisor process runs them with reap_pid() (e.g. after waitpid() reports the death)
+// or with reap_dead() (given a liveness predicate, e.g. kill(pid, 0) failing with ESRCH).
+// every record is released or reaped exactly once, even if several supervisors reap at the same time.
+// the table holds no pointers, so it may be mapped at different addresses in different processes. it is placed directly in the mapping -
+// a freshly created (zero-filled) mapping is already a valid empty table, or it can be constructed with placement new.
+// WARNING - the table relies on lock-free (address-free) atomics, which is what makes it usable across processes.
+// WARNING - pids are only unique among live processes. reap_pid() after waitpid() is exact, but reap_dead() on a pid that was reused by an unrelated process will (harmlessly) not reap it.
+template<typename Record = robust_fate_record, std::size_t N = 1024>
+class robust_fate_table
+{
+public: // -- types -- //
+
+	static_assert(std::is_trivially_copyable_v<Record>, "robust_fate_table records must be plain data");
+
+	// identifies an armed record. a default-constructed handle refers to nothing.
+	struct handle
+	{
+		std::size_t index = 0;
+		std::uint64_t word = 0; // the slot's state word as armed - 0 for no record
+
+		explicit operator bool() const noexcept { return word != 0; }
+		bool operator!() const noexcept { return word == 0; }
+	};
+
+private: // -- data -- //
+
+	// each slot's state word packs the owner pid (low 32 bits), a 2-bit tag, and a generation count (the rest) that is bumped on every arm,
+	// so that a stale handle can never release somebody else's record
+	static constexpr std::uint64_t tag_free = 0;
+	static constexpr std::uint64_t tag_claiming = 1; // being written by its owner
+	static constexpr std::uint64_t tag_armed = 2;
+	static constexpr std::uint64_t tag_reaping = 3; // being run by a supervisor
+
+	static constexpr std::uint64_t make_word(std::uint64_t gen, std::uint64_t tag, std::uint32_t pid) noexcept { return (gen << 34) | (tag << 32) | pid; }
+	static constexpr std::uint64_t gen_of(std::uint64_t w) noexcept { return w >> 34; }
+	static constexpr std::uint64_t tag_of(std::uint64_t w) noexcept { return (w >> 32) & 3; }
+	static constexpr std::uint32_t pid_of(std::uint64_t w) noexcept { return (std::uint32_t)w; }
+
+	struct slot
+	{
+		std::atomic<std::uint64_t> state{0};
+		Record record{};
+	};
+
+	static_assert(std::atomic<std::uint64_t>::is_always_lock_free, "robust_fate_table requires lock-free 64-bit atomics");
+
+	// where the next claim starts scanning (just spreads claims out - correctness doesn't depend on it)
+	std::atomic<std::uint64_t> hint{0};
+
+	slot slots[N];
+
+	// reaps one slot if its state word is still w. returns true iff this call ran it.
+	template<typename F>
+	bool reap_slot(slot &s, std::uint64_t w, F &run)
+	{
+		if (tag_of(w) == tag_claiming)
+		{
+			// the owner died half-way through arming - there's no complete record to run, just recycle the slot
+			s.state.compare_exchange_strong(w, make_word(gen_of(w), tag_free, 0), std::memory_order_relaxed);
+			return false;
+		}
+		if (!s.state.compare_exchange_strong(w, make_word(gen_of(w), tag_reaping, pid_of(w)), std::memory_order_acquire, std::memory_order_relaxed)) return false;
+
+		// fate semantics - exceptions are caught and ignored
+		try { run(pid_of(w), static_cast<const Record&>(s.record)); }
+		catch (...) {}
+
+		s.state.store(make_word(gen_of(w), tag_free, 0), std::memory_order_release);
+		return true;
+	}
+
+public: // -- ctor / dtor / asgn -- //
+
+	// creates an empty table. equivalent to zero-filling the memory it occupies.
+	constexpr robust_fate_table() noexcept = default;
+
+	robust_fate_table(const robust_fate_table&) = delete;
+	robust_fate_table &operator=(const robust_fate_table&) = delete;
+
+public: // -- worker interface -- //
+
+	// returns the number of slots
+	static constexpr std::size_t capacity() noexcept { return N; }
+
+	// arms a record on behalf of the given (live, calling) process. threadsafe and lock-free, across processes.
+	// returns a null handle if pid is 0 or the table is full.
+	handle arm(std::uint32_t pid, const Record &record) noexcept
+	{
+		if (pid == 0) return {};
+		const std::size_t start = (std::size_t)(hint.fetch_add(1, std::memory_order_relaxed) % N);
+		for (std::size_t i = 0; i < N; ++i)
+		{
+			const std::size_t index = (start + i) % N;
+			slot &s = slots[index];
+			std::uint64_t w = s.state.load(std::memory_order_relaxed);
+			if (tag_of(w) != tag_free) continue;
+			if (!s.state.compare_exchange_strong(w, make_word(gen_of(w) + 1, tag_claiming, pid), std::memory_order_acquire, std::memory_order_relaxed)) continue;
+
+			s.record = record;
+			const std::uint64_t armed = make_word(gen_of(w) + 1, tag_armed, pid);
+			s.state.store(armed, std::memory_order_release);
+			return {index, armed};
+		}
+		return {};
+	}
+
+	// releases an armed record (the owner cleaned up itself, so it will never be reaped). threadsafe and lock-free.
+	// returns true iff the record was still armed.
+	bool release(handle h) noexcept
+	{
+		if (!h || h.index >= N) return false;
+		std::uint64_t w = h.word;
+		return slots[h.index].state.compare_exchange_strong(w, make_word(gen_of(w), tag_free, 0), std::memory_order_relaxed);
+	}
+
+	// releases every record armed by the given process (e.g. on its clean exit). returns the number released.
+	std::size_t release_all(std::uint32_t pid) noexcept
+	{
+		std::size_t n = 0;
+		for (slot &s : slots)
+		{
+			std::uint64_t w = s.state.load(std::memory_order_relaxed);
+			if (tag_of(w) == tag_armed && pid_of(w) == pid && s.state.compare_exchange_strong(w, make_word(gen_of(w), tag_free, 0), std::memory_order_relaxed)) ++n;
+		}
+		return n;
+	}
+
+public: // -- supervisor interface -- //
+
+	// runs (via run(pid, record)) and frees every record left armed by the given process, which must be dead.
+	// returns the number of records run. if run throws, the exception is caught and ignored (and the record is still freed).
+	template<typename F>
+	std::size_t reap_pid(std::uint32_t pid, F &&run)
+	{
+		std::size_t n = 0;
+		for (slot &s : slots)
+		{
+			const std::uint64_t w = s.state.load(std::memory_order_relaxed);
+			if (pid != 0 && pid_of(w) == pid && (tag_of(w) == tag_armed || tag_of(w) == tag_claiming)) n += reap_slot(s, w, run);
+		}
+		return n;
+	}
+
+	// runs (via run(pid, record)) and frees every record whose owner is dead according to is_alive(pid).
+	// consecutive slots owned by the same pid share one is_alive() call, so a syscall per call is fine.
+	// returns the number of records run.
+	template<typename Alive, typename F>
+	std::size_t reap_dead(Alive &&is_alive, F &&run)
+	{
+		std::size_t n = 0;
+		std::uint32_t last_pid = 0;
+		bool last_alive = true;
+		for (slot &s : slots)
+		{
+			const std::uint64_t w = s.state.load(std::memory_order_relaxed);
+			if (tag_of(w) != tag_armed && tag_of(w) != tag_claiming) continue;
+			if (pid_of(w) != last_pid)
+			{
+				last_pid = pid_of(w);
+				last_alive = is_alive(last_pid);
+			}
+			if (!last_alive) n += reap_slot(s, w, run);
+		}
+		return n;
+	}
+
+	// returns the number of armed records (a snapshot)
+	std::size_t size() const noexcept
+	{
+		std::size_t n = 0;
+		for (const slot &s : slots) n += tag_of(s.state.load(std::memory_order_relaxed)) == tag_armed;
+		return n;
+	}
+};
+
+// robust_fate pairs a local fate with a record armed in a robust_fate_table on its behalf.
+// while the process is alive it behaves like a fate: invoking it runs the local function and then releases the record, and release() abandons both.
+// if the process dies first, the supervisor runs the record instead - so the cleanup happens exactly once either way.
+// (in the window between the local function finishing and the record being released, a hard death leads to the record being run as well,
+// so the operation should be idempotent - e.g. unlinking a file that's already gone.)
+template<typename Table, typename T>
+class robust_fate
+{
+private: // -- data -- //
+
+	Table *table;
+	typename Table::handle h;
+	fate<T> func;
+
+public: // -- ctor / dtor / asgn -- //
+
+	// creates a robust_fate that is not associated with anything (empty)
+	robust_fate() noexcept : table(nullptr), h{} {}
+
+	// arms the record in the table on behalf of pid and binds the local function (the argument will be forwarded to the T constructor).
+	// on failure (including a full table), an exception is thrown and nothing is left armed.
+	template<typename Record, typename J>
+	robust_fate(Table &t, std::uint32_t pid, const Record &record, J &&arg) : table(&t), h{}, func(std::forward<J>(arg))
+	{
+		h = t.arm(pid, record);
+		if (!h)
+		{
+			func.release();
+			throw std::length_error("robust_fate_table is full");
+		}
+	}
+
+	~robust_fate() { (*this)(); }
+
+	robust_fate(const robust_fate&) = delete;
+	robust_fate &operator=(const robust_fate&) = delete;
+
+	// constructs a new robust_fate by transfering other's contract to the new instance
+	robust_fate(robust_fate &&other) noexcept(std::is_nothrow_move_constructible_v<fate<T>>) : table(other.table), h(other.h), func(std::move(other.func))
+	{
+		other.h = {};
+	}
+	// if this instance currently holds a function, it is triggered. after this, other's contract is transfered to this instance.
+	// in the special case of self-assignment, does nothing.
+	robust_fate &operator=(robust_fate &&other) noexcept(std::is_nothrow_move_assignable_v<fate<T>>)
+	{
+		if (this != &other)
+		{
+			(*this)();
+			func = std::move(other.func);
+			table = other.table;
+			h = other.h;
+			other.h = {};
+		}
+		return *this;
+	}
+
+public: // -- utilities -- //
+
+	// runs the local function (if any), then releases the record.
+	// if the function-like object throws an exception, it is caught and ignored.
+	// the resulting object is guaranteed to be empty after this.
+	void operator()() noexcept
+	{
+		if (h)
+		{
+			func();
+			table->release(h);
+			h = {};
+		}
+	}
+
+	// abandons the function and releases the record (neither will be executed)
+	void release() noexcept
+	{
+		if (h)
+		{
+			func.release();
+			table->release(h);
+			h = {};
+		}
+	}
+
+	// returns true iff this object is still associated with a function object
+	explicit operator bool() const noexcept { return (bool)h; }
+	// returns true iff this object is not associated with a function object
+	bool operator!() const noexcept { return !h; }
+
+	// returns true iff this object is not associated with a function object
+	bool empty() const noexcept { return !h; }
+};
+
+// creates a robust_fate that arms record in table on behalf of pid and binds the given function-like object locally
+template<typename Table, typename Record, typename T>
+robust_fate<Table, std::decay_t<T>> make_robust_fate(Table &table, std::uint32_t pid, const Record &record, T &&arg)
+{
+	return robust_fate<Table, std::decay_t<T>>(table, pid, record, std::forward<T>(arg));
+}
+
+#endif
@@ -0,0 +1,87 @@
+#ifndef DRAGAZO_ROLLBACK_GUARD_H
+#define DRAGAZO_ROLLBACK_GUARD_H
+
+#include <utility>
+#include <type_traits>
+
+// marks a function as rarely called and keeps it out of its callers
+#if defined(__GNUC__) || defined(__clang__)
+#define DRAGAZO_COLD_NOINLINE __attribute__((noinline, cold))
+#define DRAGAZO_UNLIKELY(x) __builtin_expect(!!(x), 0)
+#elif defined(_MSC_VER)
+#define DRAGAZO_COLD_NOINLINE __declspec(noinline)
+#define DRAGAZO_UNLIKELY(x) (x)
+#else
+#define DRAGAZO_COLD_NOINLINE
+#define DRAGAZO_UNLIKELY(x) (x)
+#endif
+
+// rollback_guard is a fate for the common case where the function almost never runs (it's release()d on the success path).
+// with a plain fate the compiler happily inlines the cleanup body into the guarded function, bloating it with code that never runs.
+// rollback_guard instead keeps the invoke path out of line and marked cold (so it lands in the cold text section with the other unlikely code),
+// and the hot path is reduced to the armed check at scope exit plus release(), which is a single byte store.
+// unlike fate, the function-like object lives until the guard is destroyed (release() only disarms it), which is what keeps release() to a single store.
+// as with fate, exceptions thrown by the function are caught and ignored.
+template<typename T>
+class rollback_guard
+{
+private: // -- data -- //
+
+	T func;
+	bool armed;
+
+	// the cold path - invokes the function and disarms
+	DRAGAZO_COLD_NOINLINE void fire() noexcept
+	{
+		armed = false;
+		try { func(); }
+		catch (...) {}
+	}
+
+public: // -- ctor / dtor / asgn -- //
+
+	// creates an armed guard for the given function-like object - the argument will be forwarded to the T constructor.
+	// on failure, an exception is thrown.
+	template<typename J, std::enable_if_t<!std::is_same_v<std::decay_t<J>, rollback_guard>, int> = 0>
+	explicit rollback_guard(J &&arg) noexcept(std::is_nothrow_constructible_v<T, J&&>) : func(std::forward<J>(arg)), armed(true) {}
+
+	~rollback_guard()
+	{
+		if (DRAGAZO_UNLIKELY(armed)) fire();
+	}
+
+	rollback_guard(const rollback_guard&) = delete;
+	rollback_guard &operator=(const rollback_guard&) = delete;
+
+	// constructs a new guard by transfering other's contract to the new instance (other is disarmed)
+	rollback_guard(rollback_guard &&other) noexcept(std::is_nothrow_move_constructible_v<T>) : func(std::move(other.func)), armed(other.armed)
+	{
+		other.armed = false;
+	}
+	rollback_guard &operator=(rollback_guard&&) = delete;
+
+public: // -- utilities -- //
+
+	// triggers the function now (if armed). the guard is disarmed afterwards.
+	void operator()() noexcept
+	{
+		if (DRAGAZO_UNLIKELY(armed)) fire();
+	}
+
+	// disarms the guard (the function will not be executed). a single store.
+	void release() noexcept { armed = false; }
+
+	// returns true iff the guard is still armed
+	explicit operator bool() const noexcept { return armed; }
+	// returns true iff the guard is not armed
+	bool operator!() const noexcept { return !armed; }
+
+	// returns true iff the guard is not armed
+	bool empty() const noexcept { return !armed; }
+};
+
+// creates a rollback_guard object from the given function-like object
+template<typename T>
+rollback_guard<std::decay_t<T>> make_rollback_guard(T &&arg) { return rollback_guard<std::decay_t<T>>(std::forward<T>(arg)); }
+
+#endif
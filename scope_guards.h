@@ -0,0 +1,133 @@
+#ifndef DRAGAZO_SCOPE_GUARDS_H
+#define DRAGAZO_SCOPE_GUARDS_H
+
+#include <exception>
+#include <utility>
+#include <type_traits>
+
+#include "fate.h"
+
+// scope_group samples the exception state once on behalf of a group of scope_success/scope_failure guards.
+// a lone guard has to call std::uncaught_exceptions() twice (once when it's created and once when it's destroyed) to find out whether it's being
+// destroyed by stack unwinding - with many guards per scope, those calls add up. guards constructed with a scope_group share its sample instead:
+// the group calls std::uncaught_exceptions() once when it's created and once more when the first of its guards is destroyed, no matter how many guards it has.
+// WARNING - the group's guards must all be destroyed by the same scope exit (i.e. declared after the group, in the same scope),
+// since the first guard's answer is reused for the rest.
+class scope_group
+{
+private: // -- data -- //
+
+	// std::uncaught_exceptions() when the group was created
+	int uncaught;
+	// -1 until the first guard asks, then whether the scope is being left by an exception
+	mutable signed char failed;
+
+public: // -- ctor / dtor / asgn -- //
+
+	scope_group() noexcept : uncaught(std::uncaught_exceptions()), failed(-1) {}
+
+	scope_group(const scope_group&) = delete;
+	scope_group &operator=(const scope_group&) = delete;
+
+public: // -- interface -- //
+
+	// returns true iff the scope is being left by an exception (sampled once, on the first call)
+	bool failing() const noexcept
+	{
+		if (failed < 0) failed = std::uncaught_exceptions() > uncaught;
+		return failed;
+	}
+};
+
+// base for scope_success and scope_failure: a fate that's either invoked or released on destruction, depending on how the scope is left
+template<typename T, bool OnFailure>
+class scope_guard_base
+{
+private: // -- data -- //
+
+	fate<T> func;
+
+	// the group to ask, or null if this guard samples the exception state itself
+	const scope_group *group;
+	int uncaught;
+
+	bool failing() const noexcept { return group ? group->failing() : std::uncaught_exceptions() > uncaught; }
+
+public: // -- ctor / dtor / asgn -- //
+
+	// creates an empty guard
+	scope_guard_base() noexcept : group(nullptr), uncaught(0) {}
+
+	// creates a guard for the given function-like object that samples the exception state itself.
+	// on failure, an exception is thrown.
+	template<typename J>
+	explicit scope_guard_base(J &&arg) : func(std::forward<J>(arg)), group(nullptr), uncaught(std::uncaught_exceptions()) {}
+
+	// creates a guard for the given function-like object that shares the given group's exception state.
+	// on failure, an exception is thrown.
+	template<typename J>
+	scope_guard_base(const scope_group &g, J &&arg) : func(std::forward<J>(arg)), group(&g), uncaught(0) {}
+
+	~scope_guard_base()
+	{
+		if (func)
+		{
+			if (failing() == OnFailure) func();
+			else func.release();
+		}
+	}
+
+	scope_guard_base(const scope_guard_base&) = delete;
+	scope_guard_base &operator=(const scope_guard_base&) = delete;
+
+	// guards are tied to the scope they were created in, so they can't be moved either
+	scope_guard_base(scope_guard_base&&) = delete;
+	scope_guard_base &operator=(scope_guard_base&&) = delete;
+
+public: // -- utilities -- //
+
+	// abandons the function (will not be executed, regardless of how the scope is left)
+	void release() noexcept { func.release(); }
+
+	// returns true iff this guard is still associated with a function object
+	explicit operator bool() const noexcept { return (bool)func; }
+	// returns true iff this guard is not associated with a function object
+	bool operator!() const noexcept { return !func; }
+
+	// returns true iff this guard is not associated with a function object
+	bool empty() const noexcept { return func.empty(); }
+};
+
+// scope_success invokes its function only if the scope is left normally (e.g. a commit hook). if it's left by an exception, the function is released.
+// as with fate, exceptions thrown by the function are caught and ignored.
+template<typename T>
+class scope_success : public scope_guard_base<T, false>
+{
+public:
+	using scope_guard_base<T, false>::scope_guard_base;
+};
+
+// scope_failure invokes its function only if the scope is left by an exception (e.g. a rollback). if it's left normally, the function is released.
+// as with fate, exceptions thrown by the function are caught and ignored.
+template<typename T>
+class scope_failure : public scope_guard_base<T, true>
+{
+public:
+	using scope_guard_base<T, true>::scope_guard_base;
+};
+
+// creates a scope_success object from the given function-like object (relies on guaranteed copy elision, since guards can't be moved)
+template<typename T>
+scope_success<std::decay_t<T>> make_scope_success(T &&arg) { return scope_success<std::decay_t<T>>(std::forward<T>(arg)); }
+// creates a scope_success object from the given function-like object that shares the given group's exception state
+template<typename T>
+scope_success<std::decay_t<T>> make_scope_success(const scope_group &group, T &&arg) { return scope_success<std::decay_t<T>>(group, std::forward<T>(arg)); }
+
+// creates a scope_failure object from the given function-like object (relies on guaranteed copy elision, since guards can't be moved)
+template<typename T>
+scope_failure<std::decay_t<T>> make_scope_failure(T &&arg) { return scope_failure<std::decay_t<T>>(std::forward<T>(arg)); }
+// creates a scope_failure object from the given function-like object that shares the given group's exception state
+template<typename T>
+scope_failure<std::decay_t<T>> make_scope_failure(const scope_group &group, T &&arg) { return scope_failure<std::decay_t<T>>(group, std::forward<T>(arg)); }
+
+#endif
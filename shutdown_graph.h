@@ -0,0 +1,301 @@
+#ifndef DRAGAZO_SHUTDOWN_GRAPH_H
+#define DRAGAZO_SHUTDOWN_GRAPH_H
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <deque>
+#include <initializer_list>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "fate.h"
+
+// a shutdown_graph is a set of fate objects (nodes) with declared dependencies between them.
+// on teardown each node is invoked only after every node that depends on it has been invoked (the same guarantee reverse construction order gives you),
+// but independent branches of the graph are invoked in parallel on a small work-stealing pool.
+// a node may only depend on nodes that were added before it, so the graph is acyclic by construction.
+// every node records when it started and finished so that the critical path of teardown can be inspected afterwards.
+// adding nodes is not threadsafe - build the graph from one thread, then run() it (or let the destructor do so).
+class shutdown_graph
+{
+public: // -- types -- //
+
+	typedef std::size_t node_id;
+	typedef std::chrono::steady_clock clock;
+
+	// timing info for a node, relative to the start of run()
+	struct node_timing
+	{
+		clock::duration start{};
+		clock::duration finish{};
+		// id of the thread (0 is the thread that called run()) that invoked the node
+		std::size_t worker = 0;
+
+		clock::duration elapsed() const noexcept { return finish - start; }
+	};
+
+private: // -- data -- //
+
+	// type-erased fate (std::function won't do since cleanups are often move-only, e.g. anything holding a fate)
+	struct func_base
+	{
+		virtual ~func_base() = default;
+		virtual void run() noexcept = 0;
+		virtual void release() noexcept = 0;
+	};
+	template<typename T>
+	struct func_impl final : func_base
+	{
+		fate<T> func;
+
+		template<typename J>
+		explicit func_impl(J &&f) : func(std::forward<J>(f)) {}
+
+		void run() noexcept override { func(); }
+		void release() noexcept override { func.release(); }
+	};
+	typedef std::unique_ptr<func_base> func_ptr;
+
+	template<typename F>
+	static func_ptr make_func(F &&f) { return func_ptr(new func_impl<std::decay_t<F>>(std::forward<F>(f))); }
+	// a fate is moved into the node's own fate (rather than wrapped in another one), so that release() releases the original function
+	template<typename T>
+	static func_ptr make_func(fate<T> &&f) { return func_ptr(new func_impl<T>(std::move(f))); }
+
+	struct node
+	{
+		func_ptr func;
+		std::string name;
+		std::vector<node_id> deps;
+
+		// number of dependents that have not yet been invoked (only touched during run())
+		std::atomic<std::size_t> pending{0};
+		// total number of dependents
+		std::size_t dependents = 0;
+
+		node_timing timing;
+
+		node(func_ptr &&f, std::string &&n, std::vector<node_id> &&d) : func(std::move(f)), name(std::move(n)), deps(std::move(d)) {}
+	};
+
+	// unique_ptr so the nodes (which contain atomics) never move after being added
+	std::vector<std::unique_ptr<node>> nodes;
+
+	// marks if run() has already been called
+	bool done = false;
+
+	// a deque of ready nodes for one worker. the owner pushes/pops at the back, thieves take from the front.
+	// the critical sections are a couple of instructions long, so a plain mutex is cheaper here than it sounds.
+	struct work_queue
+	{
+		std::mutex mutex;
+		std::deque<node_id> items;
+
+		void push(node_id id)
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			items.push_back(id);
+		}
+		bool pop(node_id &id)
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			if (items.empty()) return false;
+			id = items.back();
+			items.pop_back();
+			return true;
+		}
+		bool steal(node_id &id)
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			if (items.empty()) return false;
+			id = items.front();
+			items.pop_front();
+			return true;
+		}
+	};
+
+	// invokes a node and releases any of its dependencies that are now ready onto the given queue.
+	// if a ready dependency can't be queued (out of memory), it is invoked immediately instead.
+	void execute(node_id id, std::size_t worker, work_queue &queue, clock::time_point epoch, std::atomic<std::size_t> &remaining) noexcept
+	{
+		node &n = *nodes[id];
+		n.timing.worker = worker;
+		n.timing.start = clock::now() - epoch;
+		n.func->run();
+		n.timing.finish = clock::now() - epoch;
+
+		for (node_id dep : n.deps)
+		{
+			if (nodes[dep]->pending.fetch_sub(1, std::memory_order_acq_rel) == 1)
+			{
+				try { queue.push(dep); }
+				catch (...) { execute(dep, worker, queue, epoch, remaining); }
+			}
+		}
+		remaining.fetch_sub(1, std::memory_order_acq_rel);
+	}
+
+public: // -- ctor / dtor / asgn -- //
+
+	shutdown_graph() = default;
+
+	// if the graph has not been run yet, runs it with the default number of threads
+	~shutdown_graph() { run(); }
+
+	shutdown_graph(const shutdown_graph&) = delete;
+	shutdown_graph &operator=(const shutdown_graph&) = delete;
+
+public: // -- interface -- //
+
+	// adds a cleanup node (a function-like object taking no args, or a fate object, which is moved from) that must be invoked before any of the nodes in deps (i.e. this node depends on them).
+	// every id in deps must refer to a node that has already been added - otherwise std::invalid_argument is thrown.
+	// returns the id of the new node. throws std::logic_error if the graph has already been run.
+	template<typename F>
+	node_id add(F &&f, std::initializer_list<node_id> deps = {}, std::string name = {})
+	{
+		return add(std::forward<F>(f), std::vector<node_id>(deps), std::move(name));
+	}
+	template<typename F>
+	node_id add(F &&f, std::vector<node_id> deps, std::string name = {})
+	{
+		if (done) throw std::logic_error("shutdown_graph has already been run");
+		const node_id id = nodes.size();
+		for (node_id dep : deps) if (dep >= id) throw std::invalid_argument("shutdown_graph node dependency does not exist");
+
+		nodes.emplace_back(std::make_unique<node>(make_func(std::forward<F>(f)), std::move(name), std::move(deps)));
+		for (node_id dep : nodes.back()->deps) ++nodes[dep]->dependents;
+		return id;
+	}
+
+	// returns the number of nodes in the graph
+	std::size_t size() const noexcept { return nodes.size(); }
+
+	// abandons every node (none of them will be invoked). the graph counts as having been run.
+	void release() noexcept
+	{
+		for (auto &n : nodes) n->func->release();
+		done = true;
+	}
+
+	// invokes every node in dependency order using the given number of threads (including the calling thread).
+	// a thread count of zero uses std::thread::hardware_concurrency().
+	// blocks until every node has been invoked. does nothing if the graph has already been run.
+	// as with fate, exceptions thrown by nodes are caught and ignored.
+	// if worker threads cannot be created, the remaining work is done on the calling thread.
+	void run(std::size_t threads = 0) noexcept
+	{
+		if (done) return;
+		done = true;
+		if (nodes.empty()) return;
+
+		if (threads == 0) threads = std::thread::hardware_concurrency();
+		if (threads == 0) threads = 1;
+		if (threads > nodes.size()) threads = nodes.size();
+
+		std::unique_ptr<work_queue[]> queues;
+		try { queues.reset(new work_queue[threads]); }
+		catch (...) { threads = 0; }
+
+		const clock::time_point epoch = clock::now();
+
+		// fall back to running serially in reverse order (always a valid topological order)
+		if (threads == 0)
+		{
+			for (std::size_t i = nodes.size(); i-- > 0; )
+			{
+				node &n = *nodes[i];
+				n.timing.start = clock::now() - epoch;
+				n.func->run();
+				n.timing.finish = clock::now() - epoch;
+			}
+			return;
+		}
+
+		std::atomic<std::size_t> remaining{nodes.size()};
+
+		// seed the roots (nodes nothing depends on) round-robin across the workers
+		std::size_t next = 0;
+		for (node_id id = 0; id < nodes.size(); ++id)
+		{
+			nodes[id]->pending.store(nodes[id]->dependents, std::memory_order_relaxed);
+			if (nodes[id]->dependents == 0)
+			{
+				try { queues[next++ % threads].push(id); }
+				catch (...) { execute(id, 0, queues[0], epoch, remaining); } // can't queue it, so just run it now
+			}
+		}
+
+		auto work = [&](std::size_t self) noexcept
+		{
+			node_id id;
+			while (remaining.load(std::memory_order_acquire) != 0)
+			{
+				bool found = queues[self].pop(id);
+				for (std::size_t i = 1; !found && i < threads; ++i) found = queues[(self + i) % threads].steal(id);
+
+				if (found) execute(id, self, queues[self], epoch, remaining);
+				else std::this_thread::yield();
+			}
+		};
+
+		std::vector<std::thread> workers;
+		try
+		{
+			workers.reserve(threads - 1);
+			for (std::size_t i = 1; i < threads; ++i) workers.emplace_back(work, i);
+		}
+		catch (...) {}
+
+		work(0);
+		for (auto &w : workers) w.join();
+	}
+
+public: // -- timing -- //
+
+	// returns the name given to a node when it was added
+	const std::string &name(node_id id) const { return nodes.at(id)->name; }
+
+	// returns the timing info for a node (only meaningful after run())
+	const node_timing &timing(node_id id) const { return nodes.at(id)->timing; }
+
+	// returns the longest chain of nodes (by invocation time) that had to run one after another, in the order they ran.
+	// the sum of their elapsed times is a lower bound on teardown time regardless of how many threads are used.
+	std::vector<node_id> critical_path() const
+	{
+		// cost[i] is the longest chain ending at node i (i.e. node i plus the most expensive chain of its dependents).
+		// dependents always have larger ids, so walking backwards visits them first.
+		std::vector<clock::duration> cost(nodes.size());
+		std::vector<node_id> prev(nodes.size(), nodes.size());
+		for (std::size_t i = nodes.size(); i-- > 0; ) cost[i] = nodes[i]->timing.elapsed();
+		for (std::size_t i = nodes.size(); i-- > 0; )
+		{
+			for (node_id dep : nodes[i]->deps)
+			{
+				const clock::duration through = cost[i] + nodes[dep]->timing.elapsed();
+				if (through > cost[dep])
+				{
+					cost[dep] = through;
+					prev[dep] = i;
+				}
+			}
+		}
+
+		std::vector<node_id> path;
+		if (nodes.empty()) return path;
+
+		node_id end = 0;
+		for (node_id i = 1; i < nodes.size(); ++i) if (cost[i] > cost[end]) end = i;
+		for (node_id i = end; i != nodes.size(); i = prev[i]) path.push_back(i);
+
+		// path was built from the last node to run back to the first
+		return std::vector<node_id>(path.rbegin(), path.rend());
+	}
+};
+
+#endif
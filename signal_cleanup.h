@@ -0,0 +1,257 @@
+#ifndef DRAGAZO_SIGNAL_CLEANUP_H
+#define DRAGAZO_SIGNAL_CLEANUP_H
+
+#include <atomic>
+#include <csignal>
+#include <cstddef>
+#include <cstdint>
+#include <initializer_list>
+#include <stdexcept>
+
+// signal_cleanup_registry is a fixed-size, preallocated, lock-free table of cleanups that can be run from a signal handler.
+// each entry is just a function pointer plus a context word (in the spirit of fate<T(*)()>), so there is nothing to allocate or destroy.
+// entries are armed and released (or run) from normal code, and drain() runs everything still armed (newest first) using only lock-free atomics,
+// which makes it safe to call from a signal handler (e.g. on a crash or SIGTERM), from several crashing threads at once, or re-entrantly.
+// every armed entry is run or released exactly once, no matter which of those races with which.
+// WARNING - the cleanup functions themselves run in signal context, so they must only use async-signal-safe operations (msync, unlink, close, write, ...).
+// N is the capacity - arming fails once that many entries are armed at the same time.
+template<std::size_t N = 64>
+class signal_cleanup_registry
+{
+public: // -- types -- //
+
+	// identifies an armed entry. a default-constructed handle refers to nothing.
+	// handles are never reused, so releasing or running a stale handle is a harmless no-op.
+	struct handle
+	{
+		std::size_t index = 0;
+		std::uint64_t seq = 0; // 0 for no entry
+
+		explicit operator bool() const noexcept { return seq != 0; }
+		bool operator!() const noexcept { return seq == 0; }
+	};
+
+private: // -- data -- //
+
+	// an entry's state word holds the arming sequence number (which doubles as its generation) above a 2-bit tag
+	static constexpr std::uint64_t tag_free = 0;
+	static constexpr std::uint64_t tag_claiming = 1; // being armed - not yet visible to drain()
+	static constexpr std::uint64_t tag_armed = 2;
+	static constexpr std::uint64_t tag_running = 3; // claimed by run() or drain()
+
+	struct entry
+	{
+		std::atomic<std::uint64_t> state{0};
+		std::atomic<void(*)(void*)> func{nullptr};
+		std::atomic<void*> ctx{nullptr};
+	};
+
+	static_assert(std::atomic<std::uint64_t>::is_always_lock_free, "signal_cleanup_registry requires lock-free 64-bit atomics");
+	static_assert(std::atomic<void*>::is_always_lock_free, "signal_cleanup_registry requires lock-free pointer atomics");
+
+	entry entries[N];
+
+	// source of sequence numbers (starts at 1 so that 0 can mean no entry)
+	std::atomic<std::uint64_t> next_seq{1};
+
+	// claims an armed entry and invokes it. returns false if it wasn't armed with the given sequence number (anymore).
+	bool claim_and_run(entry &e, std::uint64_t seq) noexcept
+	{
+		std::uint64_t expected = (seq << 2) | tag_armed;
+		if (!e.state.compare_exchange_strong(expected, (seq << 2) | tag_running, std::memory_order_acquire, std::memory_order_relaxed)) return false;
+
+		void (*f)(void*) = e.func.load(std::memory_order_relaxed);
+		void *ctx = e.ctx.load(std::memory_order_relaxed);
+
+		// fate semantics - exceptions are caught and ignored
+		try { f(ctx); }
+		catch (...) {}
+
+		e.state.store(tag_free, std::memory_order_release);
+		return true;
+	}
+
+public: // -- ctor / dtor / asgn -- //
+
+	// constexpr so that a registry at namespace scope is constant-initialized (and is therefore usable from a signal handler at any time)
+	constexpr signal_cleanup_registry() noexcept = default;
+
+	signal_cleanup_registry(const signal_cleanup_registry&) = delete;
+	signal_cleanup_registry &operator=(const signal_cleanup_registry&) = delete;
+
+public: // -- interface -- //
+
+	// returns the maximum number of simultaneously armed entries
+	static constexpr std::size_t capacity() noexcept { return N; }
+
+	// arms an entry that will call f(ctx) if drained. threadsafe, lock-free and async-signal-safe.
+	// returns a null handle if f is null or the registry is full.
+	handle arm(void (*f)(void*), void *ctx) noexcept
+	{
+		if (!f) return {};
+		const std::uint64_t seq = next_seq.fetch_add(1, std::memory_order_relaxed);
+		for (std::size_t i = 0; i < N; ++i)
+		{
+			entry &e = entries[i];
+			std::uint64_t expected = tag_free;
+			if (e.state.load(std::memory_order_relaxed) != tag_free) continue;
+			if (!e.state.compare_exchange_strong(expected, (seq << 2) | tag_claiming, std::memory_order_acquire, std::memory_order_relaxed)) continue;
+
+			e.func.store(f, std::memory_order_relaxed);
+			e.ctx.store(ctx, std::memory_order_relaxed);
+			e.state.store((seq << 2) | tag_armed, std::memory_order_release);
+			return {i, seq};
+		}
+		return {};
+	}
+
+	// abandons an armed entry (it will no longer be run). threadsafe, lock-free and async-signal-safe.
+	// returns true iff the entry was still armed (false if it was already run, released, or is running right now).
+	bool release(handle h) noexcept
+	{
+		if (!h || h.index >= N) return false;
+		std::uint64_t expected = (h.seq << 2) | tag_armed;
+		return entries[h.index].state.compare_exchange_strong(expected, tag_free, std::memory_order_relaxed);
+	}
+
+	// runs an armed entry now and disarms it. threadsafe.
+	// returns true iff this call ran it (false if it was already run, released, or is running right now).
+	bool run(handle h) noexcept
+	{
+		if (!h || h.index >= N) return false;
+		return claim_and_run(entries[h.index], h.seq);
+	}
+
+	// runs every armed entry, newest first, leaving them disarmed. async-signal-safe (as long as the cleanup functions are).
+	// entries that are running elsewhere (another thread, or an interrupted drain()) are skipped rather than waited on.
+	// this is a quadratic scan (it avoids any auxiliary storage), which is fine for the small capacities this is meant for.
+	void drain() noexcept
+	{
+		for (;;)
+		{
+			entry *newest = nullptr;
+			std::uint64_t newest_seq = 0;
+			for (entry &e : entries)
+			{
+				const std::uint64_t s = e.state.load(std::memory_order_relaxed);
+				if ((s & 3) == tag_armed && (s >> 2) > newest_seq)
+				{
+					newest = &e;
+					newest_seq = s >> 2;
+				}
+			}
+			if (!newest) break;
+			claim_and_run(*newest, newest_seq);
+		}
+	}
+
+	// returns the number of armed entries (a snapshot - may be stale by the time it returns)
+	std::size_t size() const noexcept
+	{
+		std::size_t n = 0;
+		for (const entry &e : entries) n += (e.state.load(std::memory_order_relaxed) & 3) == tag_armed;
+		return n;
+	}
+};
+
+// the process-wide registry used by signal_fate and the handlers installed by install_signal_cleanup_handlers()
+inline signal_cleanup_registry<> signal_cleanups;
+
+// signal handler that drains signal_cleanups, then restores the default disposition and re-raises the signal (so the process still dies the usual way)
+inline void drain_signal_cleanups_and_reraise(int sig)
+{
+	signal_cleanups.drain();
+	std::signal(sig, SIG_DFL);
+	std::raise(sig);
+}
+
+// installs drain_signal_cleanups_and_reraise as the handler for each of the given signals.
+// WARNING - this replaces any existing handlers. if you already have your own handler, call signal_cleanups.drain() from it instead.
+// throws std::runtime_error if a handler can't be installed.
+inline void install_signal_cleanup_handlers(std::initializer_list<int> sigs = { SIGTERM, SIGINT, SIGSEGV, SIGABRT, SIGFPE, SIGILL })
+{
+	for (int sig : sigs)
+	{
+		if (std::signal(sig, &drain_signal_cleanups_and_reraise) == SIG_ERR) throw std::runtime_error("failed to install signal cleanup handler");
+	}
+}
+
+// signal_fate is a fate bound to a function pointer and a context word that is also armed in signal_cleanups.
+// it is invoked exactly once: either normally (explicitly or at the end of its lifetime, like fate), or by drain() if the process is killed by a signal first.
+// it's the size of two words and arming/disarming is a couple of atomic operations, so it's cheap enough to wrap individual resources.
+// WARNING - the function can run in signal context, so it must only use async-signal-safe operations.
+class signal_fate
+{
+private: // -- data -- //
+
+	signal_cleanup_registry<>::handle h;
+
+public: // -- ctor / dtor / asgn -- //
+
+	// creates a signal_fate that is not associated with a function (empty)
+	constexpr signal_fate() noexcept : h{} {}
+
+	// creates a signal_fate that will call f(ctx). throws std::length_error if signal_cleanups is full.
+	signal_fate(void (*f)(void*), void *ctx) : h(signal_cleanups.arm(f, ctx))
+	{
+		if (!h && f) throw std::length_error("signal_cleanups is full");
+	}
+
+	~signal_fate() { (*this)(); }
+
+	signal_fate(const signal_fate&) = delete;
+	signal_fate &operator=(const signal_fate&) = delete;
+
+	// constructs a new signal_fate by transfering other's contract to the new instance
+	signal_fate(signal_fate &&other) noexcept : h(other.h)
+	{
+		other.h = {};
+	}
+	// if this instance currently holds a function, it is triggered. after this, other's contract is transfered to this instance.
+	// in the special case of self-assignment, does nothing.
+	signal_fate &operator=(signal_fate &&other) noexcept
+	{
+		if (this != &other)
+		{
+			(*this)();
+			h = other.h;
+			other.h = {};
+		}
+		return *this;
+	}
+
+public: // -- utilities -- //
+
+	// triggers the stored function (if any, and if a signal handler hasn't already run it).
+	// if the function throws an exception, it is caught and ignored.
+	// the resulting signal_fate is guaranteed to be empty after this.
+	void operator()() noexcept
+	{
+		if (h)
+		{
+			signal_cleanup_registry<>::handle _h = h;
+			h = {};
+			signal_cleanups.run(_h);
+		}
+	}
+
+	// abandons the function (will no longer be executed, neither normally nor by a signal handler)
+	void release() noexcept
+	{
+		signal_cleanups.release(h);
+		h = {};
+	}
+
+	// returns true iff this signal_fate is still associated with a function
+	explicit operator bool() const noexcept { return (bool)h; }
+	// returns true iff this signal_fate is not associated with a function
+	bool operator!() const noexcept { return !h; }
+
+	// returns true iff this signal_fate is not associated with a function
+	bool empty() const noexcept { return !h; }
+};
+
+// creates a signal_fate that will call f(ctx)
+inline signal_fate make_signal_fate(void (*f)(void*), void *ctx) { return signal_fate(f, ctx); }
+
+#endif
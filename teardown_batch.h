@@ -0,0 +1,207 @@
+#ifndef DRAGAZO_TEARDOWN_BATCH_H
+#define DRAGAZO_TEARDOWN_BATCH_H
+
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <vector>
+#include <algorithm>
+
+#include <sys/mman.h>
+#include <unistd.h>
+#if defined(__linux__)
+#include <sys/syscall.h>
+#endif
+
+#include "fate.h"
+
+// fd_teardown_batch collects file descriptors and closes them all at once (posix - close_range is used on linux 5.9+).
+// mass teardown (e.g. dropping thousands of connections) otherwise issues one close() per descriptor. the batch sorts what it collected,
+// closes every run of consecutive descriptors with a single close_range() call, and falls back to plain close() for isolated ones
+// (or everywhere, when close_range isn't available - so it works on any box).
+// descriptors are closed when the batch is flushed or destroyed. not threadsafe.
+// WARNING - a descriptor in the batch is still open until then. don't close it elsewhere in the meantime, or the batch may close a reused descriptor.
+class fd_teardown_batch
+{
+private: // -- data -- //
+
+	std::vector<int> fds;
+
+	// closes [first, last] (all of which we own) with as few syscalls as possible
+	static void close_run(int first, int last) noexcept
+	{
+#if defined(__linux__) && defined(SYS_close_range)
+		if (first != last && ::syscall(SYS_close_range, (unsigned)first, (unsigned)last, 0u) == 0) return;
+#endif
+		for (int fd = first; fd <= last; ++fd) ::close(fd);
+	}
+
+public: // -- ctor / dtor / asgn -- //
+
+	fd_teardown_batch() noexcept = default;
+
+	// closes everything that's still in the batch
+	~fd_teardown_batch() { flush(); }
+
+	fd_teardown_batch(const fd_teardown_batch&) = delete;
+	fd_teardown_batch &operator=(const fd_teardown_batch&) = delete;
+
+	fd_teardown_batch(fd_teardown_batch &&other) noexcept : fds(std::move(other.fds)) { other.fds.clear(); }
+	// closes everything in this batch, then takes over other's descriptors
+	fd_teardown_batch &operator=(fd_teardown_batch &&other) noexcept
+	{
+		if (this != &other)
+		{
+			flush();
+			fds = std::move(other.fds);
+			other.fds.clear();
+		}
+		return *this;
+	}
+
+public: // -- interface -- //
+
+	// adds a descriptor to the batch (ignores negative descriptors).
+	// never throws - if the batch can't grow, the descriptor is closed immediately instead.
+	void add(int fd) noexcept
+	{
+		if (fd < 0) return;
+		try { fds.push_back(fd); }
+		catch (...) { ::close(fd); }
+	}
+
+	// closes every descriptor in the batch now, leaving it empty
+	void flush() noexcept
+	{
+		if (fds.empty()) return;
+		std::sort(fds.begin(), fds.end());
+		fds.erase(std::unique(fds.begin(), fds.end()), fds.end());
+
+		for (std::size_t i = 0; i < fds.size(); )
+		{
+			std::size_t j = i + 1;
+			while (j < fds.size() && fds[j] == fds[j - 1] + 1) ++j;
+			close_run(fds[i], fds[j - 1]);
+			i = j;
+		}
+		fds.clear();
+	}
+
+	// abandons every descriptor in the batch (none of them will be closed by the batch)
+	void release() noexcept { fds.clear(); }
+
+	// returns the number of descriptors in the batch
+	std::size_t size() const noexcept { return fds.size(); }
+	// returns true iff the batch is empty
+	bool empty() const noexcept { return fds.empty(); }
+};
+
+// mapping_teardown_batch collects memory mappings and unmaps them all at once (posix).
+// ranges that turn out to be adjacent (e.g. buffers carved out of consecutive mmap calls, which the kernel tends to place back to back)
+// are coalesced, so each contiguous block costs a single munmap() and a single tlb shootdown.
+// mappings are unmapped when the batch is flushed or destroyed. not threadsafe.
+class mapping_teardown_batch
+{
+private: // -- data -- //
+
+	std::vector<std::pair<std::uintptr_t, std::size_t>> ranges; // (address, length)
+
+	static std::size_t page_size() noexcept
+	{
+		static const std::size_t size = (std::size_t)::sysconf(_SC_PAGESIZE);
+		return size;
+	}
+
+public: // -- ctor / dtor / asgn -- //
+
+	mapping_teardown_batch() noexcept = default;
+
+	// unmaps everything that's still in the batch
+	~mapping_teardown_batch() { flush(); }
+
+	mapping_teardown_batch(const mapping_teardown_batch&) = delete;
+	mapping_teardown_batch &operator=(const mapping_teardown_batch&) = delete;
+
+	mapping_teardown_batch(mapping_teardown_batch &&other) noexcept : ranges(std::move(other.ranges)) { other.ranges.clear(); }
+	// unmaps everything in this batch, then takes over other's mappings
+	mapping_teardown_batch &operator=(mapping_teardown_batch &&other) noexcept
+	{
+		if (this != &other)
+		{
+			flush();
+			ranges = std::move(other.ranges);
+			other.ranges.clear();
+		}
+		return *this;
+	}
+
+public: // -- interface -- //
+
+	// adds a mapping (as passed to munmap) to the batch.
+	// never throws - if the batch can't grow, the mapping is unmapped immediately instead.
+	void add(void *addr, std::size_t length) noexcept
+	{
+		if (!addr || length == 0) return;
+		try { ranges.emplace_back((std::uintptr_t)addr, length); }
+		catch (...) { ::munmap(addr, length); }
+	}
+
+	// unmaps every mapping in the batch now, coalescing adjacent ones, and leaves it empty
+	void flush() noexcept
+	{
+		if (ranges.empty()) return;
+		std::sort(ranges.begin(), ranges.end());
+
+		const std::size_t page = page_size();
+		auto end_of = [page](const std::pair<std::uintptr_t, std::size_t> &r) { return r.first + (r.second + page - 1) / page * page; };
+
+		std::uintptr_t begin = ranges[0].first;
+		std::uintptr_t end = end_of(ranges[0]);
+		for (std::size_t i = 1; i < ranges.size(); ++i)
+		{
+			if (ranges[i].first <= end)
+			{
+				end = std::max(end, end_of(ranges[i]));
+				continue;
+			}
+			::munmap((void*)begin, end - begin);
+			begin = ranges[i].first;
+			end = end_of(ranges[i]);
+		}
+		::munmap((void*)begin, end - begin);
+		ranges.clear();
+	}
+
+	// abandons every mapping in the batch (none of them will be unmapped by the batch)
+	void release() noexcept { ranges.clear(); }
+
+	// returns the number of mappings in the batch
+	std::size_t size() const noexcept { return ranges.size(); }
+	// returns true iff the batch is empty
+	bool empty() const noexcept { return ranges.empty(); }
+};
+
+// function-like object that hands a descriptor to an fd_teardown_batch (for use as a fate, in place of one that closes it directly)
+struct batched_close
+{
+	fd_teardown_batch *batch;
+	int fd;
+
+	void operator()() const noexcept { batch->add(fd); }
+};
+// function-like object that hands a mapping to a mapping_teardown_batch (for use as a fate, in place of one that unmaps it directly)
+struct batched_unmap
+{
+	mapping_teardown_batch *batch;
+	void *addr;
+	std::size_t length;
+
+	void operator()() const noexcept { batch->add(addr, length); }
+};
+
+// creates a fate that defers closing fd to the given batch
+inline fate<batched_close> make_batched_close_fate(fd_teardown_batch &batch, int fd) noexcept { return fate<batched_close>(batched_close{ &batch, fd }); }
+// creates a fate that defers unmapping [addr, addr + length) to the given batch
+inline fate<batched_unmap> make_batched_unmap_fate(mapping_teardown_batch &batch, void *addr, std::size_t length) noexcept { return fate<batched_unmap>(batched_unmap{ &batch, addr, length }); }
+
+#endif
@@ -0,0 +1,197 @@
+#ifndef DRAGAZO_THREAD_EXIT_H
+#define DRAGAZO_THREAD_EXIT_H
+
+#include <cstddef>
+#include <new>
+#include <utility>
+#include <type_traits>
+
+#include "fate.h"
+
+// at_thread_exit() registers a fate to be invoked when the calling thread exits. registered fates run in LIFO order.
+// the per-thread registry is created lazily on the first registration, so threads that never register anything pay nothing.
+// the first few entries live in a buffer inside the registry itself, and registering is a couple of plain (non-atomic) stores.
+// small function-like objects are stored inline in their entry - larger ones cost a single allocation.
+// fates registered while the registry is running (e.g. by another exit handler) are run too, before any older entries.
+// the registry runs when its thread_local is destroyed, so it interleaves with other thread_local destructors in the usual reverse-construction order.
+// anything registered after the registry has already been torn down is invoked immediately.
+class thread_exit_registry
+{
+private: // -- data -- //
+
+	// an entry holds a fate - inline if it's small enough, otherwise on the heap.
+	struct entry
+	{
+		// invokes (if run is true) or releases the stored fate, then destroys it
+		void (*finish)(void *storage, bool run) noexcept;
+		alignas(void*) unsigned char storage[3 * sizeof(void*)];
+	};
+
+	template<typename T>
+	static constexpr bool fits_inline = sizeof(fate<T>) <= sizeof(entry::storage) && alignof(fate<T>) <= alignof(void*);
+
+	template<typename T>
+	static void finish_inline(void *storage, bool run) noexcept
+	{
+		fate<T> &f = *static_cast<fate<T>*>(storage);
+		if (run) f();
+		else f.release();
+		f.~fate<T>();
+	}
+	template<typename T>
+	static void finish_heap(void *storage, bool run) noexcept
+	{
+		fate<T> *f = *static_cast<fate<T>**>(storage);
+		if (!run) f->release();
+		delete f;
+	}
+
+	// entries are stored in chunks that never move - the first one is embedded in the registry
+	static constexpr std::size_t chunk_size = 8;
+	struct chunk
+	{
+		chunk *prev = nullptr;
+		std::size_t count = 0;
+		entry entries[chunk_size];
+	};
+
+	chunk first;
+	chunk *top = &first;
+
+	// the calling thread's registry, or null if it has none yet.
+	// a separate trivially-destructible thread_local so that checking it never forces the registry into existence.
+	static thread_exit_registry *&current() noexcept
+	{
+		static thread_local thread_exit_registry *r = nullptr;
+		return r;
+	}
+	// set once the calling thread's registry has been torn down
+	static bool &finished() noexcept
+	{
+		static thread_local bool f = false;
+		return f;
+	}
+
+	thread_exit_registry() noexcept { current() = this; }
+
+	// placeholder for entries that are currently being finished (entries can't be moved, so they are finished in place)
+	static void finishing(void*, bool) noexcept {}
+
+	// returns the (unconstructed) entry just above the top of the stack, allocating a new chunk if needed.
+	// the entry only becomes part of the stack once the caller bumps top->count.
+	entry &next_slot()
+	{
+		if (top->count == chunk_size)
+		{
+			chunk *c = new chunk;
+			c->prev = top;
+			top = c;
+		}
+		return top->entries[top->count];
+	}
+
+	// finishes entries from the top down until there are none left.
+	// anything registered by an entry while it runs lands above it and is finished next.
+	// if an entry calls run()/release() itself, that nested call stops at the entry that is running.
+	void finish_all(bool run) noexcept
+	{
+		for (;;)
+		{
+			if (top->count == 0)
+			{
+				if (!top->prev) break;
+				chunk *old = top;
+				top = top->prev;
+				delete old;
+				continue;
+			}
+
+			entry &e = top->entries[top->count - 1];
+			if (e.finish == &finishing) break;
+			if (!e.finish)
+			{
+				--top->count;
+				continue;
+			}
+
+			void (*f)(void*, bool) noexcept = e.finish;
+			e.finish = &finishing;
+			f(e.storage, run);
+			e.finish = nullptr;
+		}
+	}
+
+public: // -- ctor / dtor / asgn -- //
+
+	~thread_exit_registry()
+	{
+		finish_all(true);
+		current() = nullptr;
+		finished() = true;
+	}
+
+	thread_exit_registry(const thread_exit_registry&) = delete;
+	thread_exit_registry &operator=(const thread_exit_registry&) = delete;
+
+public: // -- interface -- //
+
+	// gets the calling thread's registry, creating it on first use.
+	// returns null if the registry has already been torn down (i.e. the thread is exiting).
+	static thread_exit_registry *local() noexcept
+	{
+		if (thread_exit_registry *r = current()) return r;
+		if (finished()) return nullptr;
+		static thread_local thread_exit_registry r;
+		return &r;
+	}
+
+	// adds a fate to the top of the stack (the fate is moved from - on failure, it is left untouched and an exception is thrown)
+	template<typename T>
+	void add(fate<T> &&f)
+	{
+		if (!f) return;
+		entry &e = next_slot();
+		if constexpr (fits_inline<T>)
+		{
+			new (e.storage) fate<T>(std::move(f));
+			e.finish = &finish_inline<T>;
+		}
+		else
+		{
+			*reinterpret_cast<fate<T>**>(e.storage) = new fate<T>(std::move(f));
+			e.finish = &finish_heap<T>;
+		}
+		++top->count;
+	}
+
+	// runs every registered fate now (LIFO), leaving the registry empty
+	void run() noexcept { finish_all(true); }
+
+	// abandons every registered fate (none of them will be invoked)
+	void release() noexcept { finish_all(false); }
+
+	// returns the number of registered fates
+	std::size_t size() const noexcept
+	{
+		std::size_t n = 0;
+		for (const chunk *c = top; c; c = c->prev) n += c->count;
+		return n;
+	}
+};
+
+// registers a fate object to be invoked when the calling thread exits (the fate is moved from).
+// if the calling thread's registry has already been torn down, the fate is invoked immediately.
+template<typename T>
+void at_thread_exit(fate<T> &&f)
+{
+	if (thread_exit_registry *r = thread_exit_registry::local()) r->add(std::move(f));
+	else f();
+}
+// registers a function-like object to be invoked when the calling thread exits
+template<typename T>
+void at_thread_exit(T &&arg)
+{
+	at_thread_exit(make_fate(std::forward<T>(arg)));
+}
+
+#endif
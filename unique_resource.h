@@ -0,0 +1,109 @@
+#ifndef DRAGAZO_UNIQUE_RESOURCE_H
+#define DRAGAZO_UNIQUE_RESOURCE_H
+
+#include <utility>
+#include <type_traits>
+
+// unique_resource is a fate for the common case of a handle plus a fixed deleter (e.g. a file descriptor and close).
+// the deleter is a template argument and the empty state is the handle's invalid value (a niche), so a unique_resource is exactly sizeof(Handle) -
+// no captured lambda, no has_func flag, and the deleter is called directly (no thunk).
+// Handle must be usable as a template argument for the invalid value (an integer, enum or pointer type) - for handles whose invalid value
+// isn't a constant expression (e.g. a win32 INVALID_HANDLE_VALUE), use the corresponding integer type (e.g. std::uintptr_t) with a small deleter adapter.
+// moving a unique_resource just copies the handle and marks the source invalid, so it can be relocated by copying its bits.
+// as with fate, exceptions thrown by the deleter are caught and ignored.
+// the invalid value must be given explicitly (e.g. unique_resource<int, &close, -1>) - only pointer handles default it, to nullptr.
+// WARNING - a defaulted Handle() would be wrong for most integer handles (fd 0 is a valid descriptor, -1 is the invalid one).
+template<typename Handle>
+struct unique_resource_default_invalid
+{
+	static_assert(std::is_pointer_v<Handle>, "unique_resource needs an explicit invalid value for non-pointer handles (e.g. unique_resource<int, &close, -1>)");
+	static constexpr Handle value = Handle();
+};
+
+template<typename Handle, auto Deleter, Handle Invalid = unique_resource_default_invalid<Handle>::value>
+class unique_resource
+{
+private: // -- data -- //
+
+	// the owned handle, or Invalid if empty
+	Handle handle;
+
+	static_assert(std::is_trivially_copyable_v<Handle>, "unique_resource handles must be trivially copyable");
+
+public: // -- ctor / dtor / asgn -- //
+
+	// creates a unique_resource that doesn't own anything (empty)
+	constexpr unique_resource() noexcept : handle(Invalid) {}
+
+	// takes ownership of the given handle (which may be the invalid value, giving an empty unique_resource)
+	constexpr explicit unique_resource(Handle h) noexcept : handle(h) {}
+
+	~unique_resource() { (*this)(); }
+
+	unique_resource(const unique_resource&) = delete;
+	unique_resource &operator=(const unique_resource&) = delete;
+
+	// constructs a new unique_resource by transfering other's handle to the new instance
+	constexpr unique_resource(unique_resource &&other) noexcept : handle(other.handle)
+	{
+		other.handle = Invalid;
+	}
+	// if this instance currently owns a handle, it is deleted. after this, other's handle is transfered to this instance.
+	// in the special case of self-assignment, does nothing.
+	constexpr unique_resource &operator=(unique_resource &&other) noexcept
+	{
+		if (this != &other)
+		{
+			(*this)();
+			handle = other.handle;
+			other.handle = Invalid;
+		}
+		return *this;
+	}
+
+public: // -- utilities -- //
+
+	// deletes the owned handle (if any).
+	// if the deleter throws an exception, it is caught and ignored.
+	// the resulting unique_resource is guaranteed to be empty after this.
+	void operator()() noexcept
+	{
+		if (handle != Invalid)
+		{
+			// mark that we're empty first (so that if the deleter calls back into us we don't delete it twice)
+			Handle h = handle;
+			handle = Invalid;
+
+			try { Deleter(h); }
+			catch (...) {}
+		}
+	}
+
+	// deletes the owned handle (if any), then takes ownership of h
+	void reset(Handle h = Invalid) noexcept
+	{
+		(*this)();
+		handle = h;
+	}
+
+	// gives up ownership of the handle without deleting it, and returns it (or the invalid value if empty)
+	constexpr Handle release() noexcept
+	{
+		Handle h = handle;
+		handle = Invalid;
+		return h;
+	}
+
+	// returns the owned handle (or the invalid value if empty)
+	constexpr Handle get() const noexcept { return handle; }
+
+	// returns true iff this unique_resource owns a handle
+	constexpr explicit operator bool() const noexcept { return handle != Invalid; }
+	// returns true iff this unique_resource doesn't own a handle
+	constexpr bool operator!() const noexcept { return handle == Invalid; }
+
+	// returns true iff this unique_resource doesn't own a handle
+	constexpr bool empty() const noexcept { return handle == Invalid; }
+};
+
+#endif